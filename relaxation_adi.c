@@ -0,0 +1,212 @@
+/**
+* Alternating direction implicit (Peaceman-Rachford) solver
+* Oliver Redeyoff
+*
+* The 5 point Laplacian splits into a horizontal and a vertical part, H and V,
+* each a set of independent tridiagonal systems along the rows or the
+* columns. Each step of this solver takes 2 implicit half steps with a shift r,
+*
+*     (H + r) u* = (r - V) u    then    (V + r) u' = (r - H) u*
+*
+* where H u = 2u[i][j] - u[i][j-1] - u[i][j+1] and V likewise down the columns,
+* the edge cells being known values moved to the right hand sides:
+*
+* - the shifts cycle through Wachspress's geometric sequence between the
+*   smallest and largest eigenvalues of H, which are known for the square
+*   grid. The cycle needs only about log(size) shifts to damp every mode, so
+*   a smooth problem converges in a few cycles
+*
+* - the line systems have the same constant coefficients, r + 2 on the
+*   diagonal and -1 beside it, so for each shift the Thomas elimination is
+*   a single array of pivots shared by every line, computed before the first
+*   step
+*
+* - the row half step gives each worker a range of rows, each solved left to
+*   right. The column half step gives each worker a range of columns which
+*   it solves together, marching down the rows, so it reads and writes
+*   contiguous stretches of each row and the substitutions are vectorised
+*   across the columns instead of transposing the matrix
+*
+* The iteration stops after a cycle in which no step changed a cell by more
+* than decimal_value. Values can move either way from one step to the next,
+* so the change test is on the absolute difference.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// columns a worker's range of the column half step is a multiple of, a
+// cache line of doubles, so workers never write the same line
+#define ADI_COLUMN_CHUNK 8
+
+// state shared with the pool tasks of one solve
+typedef struct adi_solve {
+    long size;
+    int shift_count;
+    double* shifts;
+    double** pivots;        // pivots of the line systems of each shift
+    double* values;         // u, the values at the start of a step
+    double* half_values;    // u*, the values after the row half step
+    double* new_values;     // u', the values after the column half step
+    int shift;              // index of the shift of the current step
+    int changed;
+} ADI_SOLVE;
+
+// Pool task, the row half step over the worker's share of rows
+void adiRowTask(int worker, int worker_count, void* arg) {
+    ADI_SOLVE* solve = (ADI_SOLVE*)arg;
+    long n = solve->size;
+    double shift = solve->shifts[solve->shift];
+    double* pivots = solve->pivots[solve->shift];
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        const double* up = &solve->values[(i - 1)*n];
+        const double* row = &solve->values[i*n];
+        const double* down = &solve->values[(i + 1)*n];
+        double* out = &solve->half_values[i*n];
+
+        // forward substitution, the left edge cell is part of the first
+        // right hand side
+        double previous = row[0];
+        for (long j=1 ; j<n-1 ; j++) {
+            previous = ((shift - 2)*row[j] + up[j] + down[j] + previous)*pivots[j - 1];
+            out[j] = previous;
+        }
+
+        // back substitution, starting from the right edge cell
+        double next = row[n - 1];
+        for (long j=n-2 ; j>=1 ; j--) {
+            next = out[j] + pivots[j - 1]*next;
+            out[j] = next;
+        }
+    }
+}
+
+// Pool task, the column half step over the worker's share of columns, all
+// of them solved together down the rows
+void adiColumnTask(int worker, int worker_count, void* arg) {
+    ADI_SOLVE* solve = (ADI_SOLVE*)arg;
+    long n = solve->size;
+    double shift = solve->shifts[solve->shift];
+    double* pivots = solve->pivots[solve->shift];
+    double threshold = decimal_value;
+    int changed = 0;
+
+    long chunks = (n - 2 + ADI_COLUMN_CHUNK - 1)/ADI_COLUMN_CHUNK;
+    long start, end;
+    splitRange(worker, worker_count, chunks, &start, &end);
+    long j0 = 1 + start*ADI_COLUMN_CHUNK;
+    long j1 = 1 + end*ADI_COLUMN_CHUNK > n - 1 ? n - 1 : 1 + end*ADI_COLUMN_CHUNK;
+
+    // forward substitution down the rows, the top edge row is part of the
+    // first right hand side
+    for (long i=1 ; i<n-1 ; i++) {
+        const double* row = &solve->half_values[i*n];
+        const double* previous = &solve->new_values[(i - 1)*n];
+        double* out = &solve->new_values[i*n];
+        double pivot = pivots[i - 1];
+
+        for (long j=j0 ; j<j1 ; j++) {
+            out[j] = ((shift - 2)*row[j] + row[j - 1] + row[j + 1] + previous[j])*pivot;
+        }
+    }
+
+    // back substitution up the rows, starting from the bottom edge row
+    for (long i=n-2 ; i>=1 ; i--) {
+        const double* next = &solve->new_values[(i + 1)*n];
+        const double* old = &solve->values[i*n];
+        double* out = &solve->new_values[i*n];
+        double pivot = pivots[i - 1];
+
+        for (long j=j0 ; j<j1 ; j++) {
+            double new_value = out[j] + pivot*next[j];
+            changed |= fabs(new_value - old[j]) > threshold;
+            out[j] = new_value;
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Relaxes grid, a size*size matrix, with Peaceman-Rachford steps until a
+// cycle of shifts changes no value by more than decimal_value. Must be called
+// with the pool started.
+void relaxAdi(double* grid, int size) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+    long length = n - 2;
+
+    // eigenvalues of H lie in [smallest, largest], the shifts are spread
+    // geometrically between them, enough of them that each ratio is at most
+    // (sqrt(2) - 1)^-2
+    ADI_SOLVE solve;
+    solve.size = n;
+    solve.changed = 0;
+    double angle = M_PI/(2*(length + 1));
+    double smallest = 4*sin(angle)*sin(angle);
+    double largest = 4*cos(angle)*cos(angle);
+    solve.shift_count = 1 + (int)ceil(log(smallest/largest)/(2*log(sqrt(2) - 1)));
+    if (solve.shift_count < 1) {
+        solve.shift_count = 1;
+    }
+
+    solve.shifts = malloc(solve.shift_count*sizeof(double));
+    solve.pivots = malloc(solve.shift_count*sizeof(double*));
+    for (int k=0 ; k<solve.shift_count ; k++) {
+        double fraction = solve.shift_count == 1 ? 0.5 : (double)k/(solve.shift_count - 1);
+        solve.shifts[k] = largest*pow(smallest/largest, fraction);
+
+        // elimination of (r + 2) x[p] - x[p-1] - x[p+1], the eliminated
+        // coupling to the next cell is the pivot itself
+        solve.pivots[k] = malloc(length*sizeof(double));
+        double previous = 0.0;
+        for (long p=0 ; p<length ; p++) {
+            previous = 1/(solve.shifts[k] + 2 - previous);
+            solve.pivots[k][p] = previous;
+        }
+    }
+
+    // the edges are never written so every buffer keeps them
+    solve.values = malloc(n*n*sizeof(double));
+    solve.half_values = malloc(n*n*sizeof(double));
+    solve.new_values = malloc(n*n*sizeof(double));
+    memcpy(solve.values, grid, n*n*sizeof(double));
+    memcpy(solve.half_values, grid, n*n*sizeof(double));
+    memcpy(solve.new_values, grid, n*n*sizeof(double));
+
+    while (1) {
+        for (solve.shift=0 ; solve.shift<solve.shift_count ; solve.shift++) {
+            runPool(adiRowTask, &solve);
+            runPool(adiColumnTask, &solve);
+            double* swap = solve.values;
+            solve.values = solve.new_values;
+            solve.new_values = swap;
+        }
+
+        if (!solve.changed) {
+            break;
+        }
+        solve.changed = 0;
+    }
+
+    memcpy(grid, solve.values, n*n*sizeof(double));
+    for (int k=0 ; k<solve.shift_count ; k++) {
+        free(solve.pivots[k]);
+    }
+    free(solve.pivots);
+    free(solve.shifts);
+    free(solve.values);
+    free(solve.half_values);
+    free(solve.new_values);
+}
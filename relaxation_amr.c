@@ -0,0 +1,344 @@
+/**
+* Block-structured adaptive mesh refinement
+* Oliver Redeyoff
+*
+* Away from a few places, like the discontinuity at the corner of the default
+* problem, the solution is smooth and a coarse grid describes it as well as the
+* full matrix does. This solves on a hierarchy of levels instead, each with
+* twice the resolution of the one before, the last one matching the matrix:
+*
+* - every level is divided into AMR_BLOCK*AMR_BLOCK blocks of points. The base
+*   level has all of its blocks, finer levels only those covering the blocks
+*   of the level below that were flagged for refinement
+*
+* - after a level is solved its blocks are flagged where the undivided
+*   gradient, the largest difference across a point, is above a threshold.
+*   It shrinks with the spacing where the solution is smooth, so refinement
+*   concentrates where it isn't. Each flagged block is covered by 2x2 blocks
+*   of the next level, started from the interpolated coarser solution
+*
+* - the composite grid is relaxed with red-black SOR, one sweep of every level
+*   per round, coarsest first. Points next to missing blocks read them by
+*   bilinear interpolation of the coarser level, and after each round the
+*   points covered by a finer level take the fine value (injection), so
+*   information flows both ways. Rounds repeat until one changes no point by
+*   more than decimal_value
+*
+* The edge values of every level are sampled from the matrix and the matrix is
+* filled from the finest level at the end, interpolating where it wasn't
+* refined. The matrix size minus 1 must be divisible by 2^levels.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// points per side of a block
+#define AMR_BLOCK 32
+
+// one level of the hierarchy
+typedef struct amr_level {
+    long size;              // points per side of the level
+    long scale;             // matrix points per point of the level
+    long blocks_per_side;
+    double** blocks;        // values of each block, NULL for missing blocks
+    long* active;           // indexes of the blocks that exist
+    long active_count;
+} AMR_LEVEL;
+
+// state shared with the pool tasks of one solve
+typedef struct amr_solve {
+    double* grid;
+    long size;
+    int level_count;        // levels built so far
+    AMR_LEVEL* levels;
+    int level;              // level being relaxed
+    int color;              // points relaxed this half sweep, (i + j)%2
+    double omega;           // over-relaxation factor of the level
+    int changed;
+} AMR_SOLVE;
+
+// Returns 1 if a size*size matrix can be solved with the given number of
+// refinement levels
+int amrQualifies(int size, int levels) {
+    return levels >= 0 && levels < 30 && (size - 1)%(1L << levels) == 0 && (size - 1) >> levels >= 2;
+}
+
+// Returns the value of point (i, j) of a level, from its block if it exists,
+// else interpolated from the coarser levels. Edge points come from the matrix.
+double getAmrValue(AMR_SOLVE* solve, int l, long i, long j) {
+    AMR_LEVEL* level = &solve->levels[l];
+    long n = level->size;
+
+    if (i == 0 || j == 0 || i == n - 1 || j == n - 1) {
+        return solve->grid[i*level->scale*solve->size + j*level->scale];
+    }
+
+    double* block = level->blocks[(i/AMR_BLOCK)*level->blocks_per_side + j/AMR_BLOCK];
+    if (block != NULL) {
+        return block[(i%AMR_BLOCK)*AMR_BLOCK + j%AMR_BLOCK];
+    }
+
+    // the base level has every block so this always ends
+    long ci = i/2;
+    long cj = j/2;
+    double value = getAmrValue(solve, l - 1, ci, cj);
+    if (i%2 == 0 && j%2 == 0) {
+        return value;
+    } else if (i%2 == 0) {
+        return (value + getAmrValue(solve, l - 1, ci, cj + 1))/2;
+    } else if (j%2 == 0) {
+        return (value + getAmrValue(solve, l - 1, ci + 1, cj))/2;
+    }
+    return (value + getAmrValue(solve, l - 1, ci, cj + 1) + getAmrValue(solve, l - 1, ci + 1, cj)
+            + getAmrValue(solve, l - 1, ci + 1, cj + 1))/4;
+}
+
+// Returns 1 if point (i, j) of level l is covered by a block of level l+1
+static inline int isCovered(AMR_SOLVE* solve, int l, long i, long j) {
+    if (l + 1 >= solve->level_count) {
+        return 0;
+    }
+    AMR_LEVEL* finer = &solve->levels[l + 1];
+    return finer->blocks[(2*i/AMR_BLOCK)*finer->blocks_per_side + 2*j/AMR_BLOCK] != NULL;
+}
+
+// Creates block b of level l, filled from the coarser levels, or for the base
+// level with the edge values and zeros
+void addAmrBlock(AMR_SOLVE* solve, int l, long b) {
+    AMR_LEVEL* level = &solve->levels[l];
+    double* values = malloc(AMR_BLOCK*AMR_BLOCK*sizeof(double));
+    long bi = b/level->blocks_per_side;
+    long bj = b%level->blocks_per_side;
+
+    for (long li=0 ; li<AMR_BLOCK ; li++) {
+        for (long lj=0 ; lj<AMR_BLOCK ; lj++) {
+            long i = bi*AMR_BLOCK + li;
+            long j = bj*AMR_BLOCK + lj;
+            int edge = i == 0 || j == 0 || i == level->size - 1 || j == level->size - 1;
+            values[li*AMR_BLOCK + lj] = i >= level->size || j >= level->size || (l == 0 && !edge) ? 0.0 : getAmrValue(solve, l, i, j);
+        }
+    }
+
+    level->blocks[b] = values;
+    level->active[level->active_count++] = b;
+}
+
+// Sets up an empty level l
+void initAmrLevel(AMR_SOLVE* solve, int l, int levels) {
+    AMR_LEVEL* level = &solve->levels[l];
+    level->scale = 1L << (levels - l);
+    level->size = (solve->size - 1)/level->scale + 1;
+    level->blocks_per_side = (level->size + AMR_BLOCK - 1)/AMR_BLOCK;
+
+    long block_count = level->blocks_per_side*level->blocks_per_side;
+    level->blocks = calloc(block_count, sizeof(double*));
+    level->active = malloc(block_count*sizeof(long));
+    level->active_count = 0;
+}
+
+// Pool task, one half sweep of red-black SOR over the worker's share of the
+// blocks of the level being relaxed. Points of one color only read points of
+// the other, so the blocks are updated in place. The composite iteration can
+// move points either way, so the change test is on the absolute difference.
+void amrSweepTask(int worker, int worker_count, void* arg) {
+    AMR_SOLVE* solve = (AMR_SOLVE*)arg;
+    int l = solve->level;
+    AMR_LEVEL* level = &solve->levels[l];
+    long n = level->size;
+    double omega = solve->omega;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, level->active_count, &start, &end);
+
+    for (long a=start ; a<end ; a++) {
+        long b = level->active[a];
+        long bi = b/level->blocks_per_side;
+        long bj = b%level->blocks_per_side;
+        double* values = level->blocks[b];
+
+        for (long li=0 ; li<AMR_BLOCK ; li++) {
+            long i = bi*AMR_BLOCK + li;
+            long first = (solve->color + i + bj*AMR_BLOCK)%2;
+
+            for (long lj=first ; lj<AMR_BLOCK ; lj+=2) {
+                long j = bj*AMR_BLOCK + lj;
+                long k = li*AMR_BLOCK + lj;
+                if (i < 1 || j < 1 || i > n - 2 || j > n - 2 || isCovered(solve, l, i, j)) {
+                    continue;
+                }
+
+                // neighbours inside the block are read directly
+                double average;
+                if (li > 0 && lj > 0 && li < AMR_BLOCK - 1 && lj < AMR_BLOCK - 1) {
+                    average = (values[k - AMR_BLOCK] + values[k + 1] + values[k + AMR_BLOCK] + values[k - 1])/4;
+                } else {
+                    average = (getAmrValue(solve, l, i - 1, j) + getAmrValue(solve, l, i, j + 1)
+                            + getAmrValue(solve, l, i + 1, j) + getAmrValue(solve, l, i, j - 1))/4;
+                }
+                double step = omega*(average - values[k]);
+                changed |= fabs(step) > decimal_value;
+                values[k] += step;
+            }
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// One red-black SOR sweep of level l, returns 1 if it changed a point
+int sweepAmrLevel(AMR_SOLVE* solve, int l) {
+    solve->level = l;
+    solve->changed = 0;
+    for (solve->color=0 ; solve->color<2 ; solve->color++) {
+        runPool(amrSweepTask, solve);
+    }
+    return solve->changed;
+}
+
+// Copies the points of each level covered by the next one from it
+void injectAmrLevels(AMR_SOLVE* solve) {
+    for (int l=solve->level_count-1 ; l>0 ; l--) {
+        AMR_LEVEL* fine = &solve->levels[l];
+        AMR_LEVEL* coarse = &solve->levels[l - 1];
+
+        for (long a=0 ; a<fine->active_count ; a++) {
+            long b = fine->active[a];
+            long bi = b/fine->blocks_per_side;
+            long bj = b%fine->blocks_per_side;
+
+            // fine blocks start on even points, so their even points are
+            // the coarse points they cover
+            for (long li=0 ; li<AMR_BLOCK ; li+=2) {
+                for (long lj=0 ; lj<AMR_BLOCK ; lj+=2) {
+                    long ci = (bi*AMR_BLOCK + li)/2;
+                    long cj = (bj*AMR_BLOCK + lj)/2;
+                    if (ci < 1 || cj < 1 || ci > coarse->size - 2 || cj > coarse->size - 2) {
+                        continue;
+                    }
+
+                    long cb = (ci/AMR_BLOCK)*coarse->blocks_per_side + cj/AMR_BLOCK;
+                    long ck = (ci%AMR_BLOCK)*AMR_BLOCK + cj%AMR_BLOCK;
+                    double value = fine->blocks[b][li*AMR_BLOCK + lj];
+                    coarse->blocks[cb][ck] = value;
+                }
+            }
+        }
+    }
+}
+
+// Relaxes the composite grid, one sweep of every level per round, coarsest
+// first, then injecting the finer levels into the coarser ones, until a round
+// changes nothing. Solving each level to convergence in turn instead couples
+// the levels only through the single row of points along the edge of each
+// patch, and then needs as many rounds as the patches are wide. The
+// over-relaxation factor is the optimal one for the base level.
+void relaxAmrComposite(AMR_SOLVE* solve) {
+    solve->omega = 2/(1 + sin(M_PI/(solve->levels[0].size - 1)));
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int l=0 ; l<solve->level_count ; l++) {
+            changed |= sweepAmrLevel(solve, l);
+        }
+        injectAmrLevels(solve);
+    }
+}
+
+// Returns 1 if a block of level l holds a point whose undivided gradient is
+// above threshold
+int needsRefinement(AMR_SOLVE* solve, int l, long b, double threshold) {
+    AMR_LEVEL* level = &solve->levels[l];
+    long bi = b/level->blocks_per_side;
+    long bj = b%level->blocks_per_side;
+
+    for (long i=bi*AMR_BLOCK ; i<(bi + 1)*AMR_BLOCK && i<level->size-1 ; i++) {
+        for (long j=bj*AMR_BLOCK ; j<(bj + 1)*AMR_BLOCK && j<level->size-1 ; j++) {
+            if (i < 1 || j < 1) {
+                continue;
+            }
+            double across = fabs(getAmrValue(solve, l, i + 1, j) - getAmrValue(solve, l, i - 1, j));
+            double down = fabs(getAmrValue(solve, l, i, j + 1) - getAmrValue(solve, l, i, j - 1));
+            if (across > threshold || down > threshold) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Solves grid, a size*size matrix, on a hierarchy of levels refinement levels
+// above a base level, refining blocks whose undivided gradient is above
+// threshold, then writes the finest level back into it. Must be called with
+// the pool started.
+void relaxAmr(double* grid, int size, int levels, double threshold) {
+    AMR_SOLVE solve;
+    solve.grid = grid;
+    solve.size = size;
+    solve.levels = malloc((levels + 1)*sizeof(AMR_LEVEL));
+
+    // the base level has every block
+    initAmrLevel(&solve, 0, levels);
+    solve.level_count = 1;
+    for (long b=0 ; b<solve.levels[0].blocks_per_side*solve.levels[0].blocks_per_side ; b++) {
+        addAmrBlock(&solve, 0, b);
+    }
+    relaxAmrComposite(&solve);
+
+    for (int l=1 ; l<=levels ; l++) {
+        AMR_LEVEL* coarse = &solve.levels[l - 1];
+        initAmrLevel(&solve, l, levels);
+        AMR_LEVEL* fine = &solve.levels[l];
+
+        // flag every block before adding any, the new ones would change the
+        // values the indicator reads
+        char* flagged = calloc(coarse->active_count, 1);
+        for (long a=0 ; a<coarse->active_count ; a++) {
+            flagged[a] = needsRefinement(&solve, l - 1, coarse->active[a], threshold);
+        }
+
+        for (long a=0 ; a<coarse->active_count ; a++) {
+            if (!flagged[a]) {
+                continue;
+            }
+            long bi = coarse->active[a]/coarse->blocks_per_side;
+            long bj = coarse->active[a]%coarse->blocks_per_side;
+            for (long fi=2*bi ; fi<2*bi+2 && fi<fine->blocks_per_side ; fi++) {
+                for (long fj=2*bj ; fj<2*bj+2 && fj<fine->blocks_per_side ; fj++) {
+                    addAmrBlock(&solve, l, fi*fine->blocks_per_side + fj);
+                }
+            }
+        }
+        free(flagged);
+
+        solve.level_count = l + 1;
+        if (fine->active_count == 0) {
+            continue;
+        }
+        relaxAmrComposite(&solve);
+    }
+
+    // the matrix is the finest level's index space
+    long n = size;
+    for (long i=1 ; i<n-1 ; i++) {
+        for (long j=1 ; j<n-1 ; j++) {
+            grid[i*n + j] = getAmrValue(&solve, levels, i, j);
+        }
+    }
+
+    for (int l=0 ; l<=levels ; l++) {
+        AMR_LEVEL* level = &solve.levels[l];
+        for (long a=0 ; a<level->active_count ; a++) {
+            free(level->blocks[level->active[a]]);
+        }
+        free(level->blocks);
+        free(level->active);
+    }
+    free(solve.levels);
+}
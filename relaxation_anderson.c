@@ -0,0 +1,323 @@
+/**
+* Anderson acceleration of fixed point sweeps
+* Oliver Redeyoff
+*
+* A relaxation sweep is a fixed point map, and plain relaxation just iterates
+* it. Anderson mixing instead combines the last few images so that the step
+* extrapolates past what the sweeps do:
+*
+* - the map G is about ANDERSON_SWEEPS sweeps in a row. Mixing after every
+*   sweep takes far fewer sweeps than plain relaxation, but each mix streams
+*   through 2 arrays per column of history and costs several sweeps, so
+*   mixing after a run of sweeps is much faster overall
+*
+* - with f = G(x) - x the residual of an iterate, the differences between
+*   consecutive residuals and consecutive images of the last history
+*   iterates are kept as the columns of dF and dG. Each iteration finds the
+*   gamma minimising |f - dF gamma| and moves to G(x) - dG gamma
+*
+* - the map is any function that takes the iterate at one pointer to its image
+*   at another, or updates it in place, so the sweep based modes gain the
+*   acceleration without their kernels changing. The iterate is a flat vector
+*   in whatever layout or reduced region the mode keeps its cells, and cells
+*   no sweep writes, the edges and any padding, have no residual and drop out
+*   of the mixing
+*
+* - the residual, the newest differences and their dot products with the
+*   other columns and with f are all computed in one parallel pass, each
+*   worker adding up its share of the vector. The normal equations of the
+*   least squares problem are kept from one iteration to the next, only the
+*   row and column of the newest difference being new, and are solved on the
+*   calling thread, being history*history. If they turn out singular the
+*   history is dropped and the iteration starts again from a plain sweep
+*
+* The iteration stops when an image differs from its iterate by no more than
+* the mode's threshold anywhere, which is stricter than stopping on a single
+* sweep as it covers a run of them, and that image is the result. Mixing can
+* move values either way, so this test is on the absolute difference.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// sums of one worker's share in the residual pass, aligned so that workers
+// don't share cache lines
+typedef struct anderson_partial {
+    double largest;                             // largest residual
+    double gram[ANDERSON_MAX_HISTORY];          // newest dF column . each dF column
+    double projection[ANDERSON_MAX_HISTORY];    // each dF column . f
+} __attribute__((aligned(64))) ANDERSON_PARTIAL;
+
+// state shared with the pool tasks of one solve
+typedef struct anderson_solve {
+    FIXED_POINT_MAP* map;
+    long length;
+    double* iterate;        // x
+    double* image;          // G(x), about ANDERSON_SWEEPS sweeps of x
+    int history;
+    int columns;            // columns of dF and dG in use
+    int newest;             // column of the newest differences, -1 for none
+    double* last_residual;
+    double* last_image;
+    double** residual_differences;
+    double** image_differences;
+    double* gamma;
+    ANDERSON_PARTIAL* partials;
+} ANDERSON_SOLVE;
+
+// Pool task, computes the residual of the worker's share of the vector, its
+// newest differences and the dot products of the residual pass
+void andersonResidualTask(int worker, int worker_count, void* arg) {
+    ANDERSON_SOLVE* solve = (ANDERSON_SOLVE*)arg;
+    ANDERSON_PARTIAL* partial = &solve->partials[worker];
+    int columns = solve->columns;
+    int newest = solve->newest;
+
+    long start, end;
+    splitRange(worker, worker_count, solve->length, &start, &end);
+    const double* x = &solve->iterate[start];
+    const double* g = &solve->image[start];
+    double* last_f = &solve->last_residual[start];
+    double* last_g = &solve->last_image[start];
+    long count = end - start;
+
+    if (newest >= 0) {
+        double* df = &solve->residual_differences[newest][start];
+        double* dg = &solve->image_differences[newest][start];
+        for (long k=0 ; k<count ; k++) {
+            df[k] = g[k] - x[k] - last_f[k];
+            dg[k] = g[k] - last_g[k];
+        }
+    }
+
+    double largest = 0.0;
+    for (long k=0 ; k<count ; k++) {
+        double f = g[k] - x[k];
+        double magnitude = fabs(f);
+        largest = magnitude > largest ? magnitude : largest;
+        last_f[k] = f;
+        last_g[k] = g[k];
+    }
+
+    for (int c=0 ; c<columns ; c++) {
+        partial->gram[c] = 0.0;
+        partial->projection[c] = 0.0;
+    }
+    if (newest >= 0) {
+        const double* df_newest = &solve->residual_differences[newest][start];
+        for (int c=0 ; c<columns ; c++) {
+            const double* df = &solve->residual_differences[c][start];
+            double gram = 0.0;
+            double projection = 0.0;
+            for (long k=0 ; k<count ; k++) {
+                gram += df[k]*df_newest[k];
+                projection += df[k]*last_f[k];
+            }
+            partial->gram[c] = gram;
+            partial->projection[c] = projection;
+        }
+    }
+
+    partial->largest = largest;
+}
+
+// Pool task, writes the mixed iterate G(x) - dG gamma over the worker's share
+// of the vector to where the map reads its next iterate
+void andersonMixTask(int worker, int worker_count, void* arg) {
+    ANDERSON_SOLVE* solve = (ANDERSON_SOLVE*)arg;
+
+    long start, end;
+    splitRange(worker, worker_count, solve->length, &start, &end);
+    double* x = &solve->iterate[start];
+
+    memcpy(x, &solve->image[start], (end - start)*sizeof(double));
+    for (int c=0 ; c<solve->columns ; c++) {
+        const double* dg = &solve->image_differences[c][start];
+        double gamma = solve->gamma[c];
+        for (long k=0 ; k<end-start ; k++) {
+            x[k] -= gamma*dg[k];
+        }
+    }
+}
+
+// Solves the count*count system matrix x = rhs into x by Gaussian elimination
+// with partial pivoting, matrix and rhs being overwritten. Returns 0 if the
+// system is singular to working precision.
+int solveSmallSystem(double* matrix, double* rhs, double* x, int count) {
+    double scale = 0.0;
+    for (int k=0 ; k<count ; k++) {
+        scale = fabs(matrix[k*count + k]) > scale ? fabs(matrix[k*count + k]) : scale;
+    }
+
+    for (int k=0 ; k<count ; k++) {
+        int pivot = k;
+        for (int r=k+1 ; r<count ; r++) {
+            if (fabs(matrix[r*count + k]) > fabs(matrix[pivot*count + k])) {
+                pivot = r;
+            }
+        }
+        if (!(fabs(matrix[pivot*count + k]) > 1e-13*scale)) {
+            return 0;
+        }
+        if (pivot != k) {
+            for (int c=0 ; c<count ; c++) {
+                double swap = matrix[k*count + c];
+                matrix[k*count + c] = matrix[pivot*count + c];
+                matrix[pivot*count + c] = swap;
+            }
+            double swap = rhs[k];
+            rhs[k] = rhs[pivot];
+            rhs[pivot] = swap;
+        }
+        for (int r=k+1 ; r<count ; r++) {
+            double factor = matrix[r*count + k]/matrix[k*count + k];
+            for (int c=k ; c<count ; c++) {
+                matrix[r*count + c] -= factor*matrix[k*count + c];
+            }
+            rhs[r] -= factor*rhs[k];
+        }
+    }
+
+    for (int k=count-1 ; k>=0 ; k--) {
+        double sum = rhs[k];
+        for (int c=k+1 ; c<count ; c++) {
+            sum -= matrix[k*count + c]*x[c];
+        }
+        x[k] = sum/matrix[k*count + k];
+    }
+    return 1;
+}
+
+// Iterates map, over vectors of length doubles, with Anderson mixing over the
+// last history iterates (at most ANDERSON_MAX_HISTORY) after every run of
+// about ANDERSON_SWEEPS sweeps, until a run changes no value by more than
+// threshold. On return *map->values and *map->new_values are the buffers it
+// was called with and *map->values holds the result. Must be called with the
+// pool started.
+void accelerateAnderson(FIXED_POINT_MAP* map, long length, double threshold, int history, int worker_count) {
+    long n = length;
+    history = history < ANDERSON_MAX_HISTORY ? history : ANDERSON_MAX_HISTORY;
+    int sweeps = map->sweeps > 0 ? map->sweeps : 1;
+    int applications = (ANDERSON_SWEEPS + sweeps - 1)/sweeps;
+    int in_place = map->new_values == NULL;
+
+    ANDERSON_SOLVE solve;
+    solve.map = map;
+    solve.length = n;
+    solve.history = history;
+    solve.columns = 0;
+    solve.newest = -1;
+    solve.last_residual = malloc(n*sizeof(double));
+    solve.last_image = malloc(n*sizeof(double));
+    solve.residual_differences = malloc(history*sizeof(double*));
+    solve.image_differences = malloc(history*sizeof(double*));
+    for (int c=0 ; c<history ; c++) {
+        solve.residual_differences[c] = malloc(n*sizeof(double));
+        solve.image_differences[c] = malloc(n*sizeof(double));
+    }
+    solve.gamma = malloc(history*sizeof(double));
+    solve.partials = aligned_alloc(64, worker_count*sizeof(ANDERSON_PARTIAL));
+
+    // normal equations dF^T dF gamma = dF^T f, gram kept between iterations
+    double* gram = malloc(history*history*sizeof(double));
+    double* matrix = malloc(history*history*sizeof(double));
+    double* rhs = malloc(history*sizeof(double));
+    int iteration = 0;
+
+    // the applications alternate between 2 buffers, or an in place map works
+    // on a copy, so that the iterate is still there to mix with the image
+    double* values = *map->values;
+    double* new_values = in_place ? NULL : *map->new_values;
+    double* buffers[2] = {in_place ? malloc(n*sizeof(double)) : new_values, malloc(n*sizeof(double))};
+    memcpy(buffers[1], values, n*sizeof(double));
+    solve.iterate = values;
+
+    while (1) {
+        if (in_place) {
+            memcpy(buffers[0], solve.iterate, n*sizeof(double));
+            *map->values = buffers[0];
+            for (int a=0 ; a<applications ; a++) {
+                map->sweep(map->arg);
+            }
+            solve.image = buffers[0];
+        } else {
+            double* input = solve.iterate;
+            for (int a=0 ; a<applications ; a++) {
+                *map->values = input;
+                *map->new_values = buffers[a%2];
+                map->sweep(map->arg);
+                input = buffers[a%2];
+            }
+            solve.image = input;
+        }
+        runPool(andersonResidualTask, &solve);
+
+        double largest = 0.0;
+        for (int w=0 ; w<worker_count ; w++) {
+            largest = solve.partials[w].largest > largest ? solve.partials[w].largest : largest;
+        }
+        if (largest <= threshold) {
+            break;
+        }
+
+        if (solve.newest >= 0) {
+            for (int c=0 ; c<solve.columns ; c++) {
+                double dot = 0.0;
+                double projection = 0.0;
+                for (int w=0 ; w<worker_count ; w++) {
+                    dot += solve.partials[w].gram[c];
+                    projection += solve.partials[w].projection[c];
+                }
+                gram[solve.newest*history + c] = dot;
+                gram[c*history + solve.newest] = dot;
+                rhs[c] = projection;
+            }
+
+            for (int r=0 ; r<solve.columns ; r++) {
+                for (int c=0 ; c<solve.columns ; c++) {
+                    matrix[r*solve.columns + c] = gram[r*history + c];
+                }
+            }
+            if (!solveSmallSystem(matrix, rhs, solve.gamma, solve.columns)) {
+                solve.columns = 0;
+                iteration = 0;
+            }
+        }
+
+        runPool(andersonMixTask, &solve);
+
+        // the next residual pass fills the next column, oldest first once
+        // they are all in use
+        solve.newest = iteration%history;
+        solve.columns = iteration < history ? iteration + 1 : history;
+        iteration++;
+    }
+
+    // the last image is the result, handed back in the caller's buffer
+    memcpy(values, solve.image, n*sizeof(double));
+    *map->values = values;
+    if (!in_place) {
+        *map->new_values = new_values;
+    } else {
+        free(buffers[0]);
+    }
+    free(buffers[1]);
+
+    for (int c=0 ; c<history ; c++) {
+        free(solve.residual_differences[c]);
+        free(solve.image_differences[c]);
+    }
+    free(solve.residual_differences);
+    free(solve.image_differences);
+    free(solve.last_residual);
+    free(solve.last_image);
+    free(solve.gamma);
+    free(solve.partials);
+    free(gram);
+    free(matrix);
+    free(rhs);
+}
@@ -0,0 +1,319 @@
+/**
+* Banded direct solver with factor caching
+* Oliver Redeyoff
+*
+* Numbering the interior cells row by row, the 5-point system A u = b which
+* relaxation converges to is symmetric positive definite with a half bandwidth
+* of one interior row. Its Cholesky factor L keeps that band, so:
+*
+* 1 - A = L L^T is factorised once per grid shape, which only depends on the
+*     shape and not on the edge values. Factors are kept in memory for the rest
+*     of the run and, when a cache directory is given, written to disk so that
+*     later runs skip the factorisation entirely
+*
+* 2 - every grid to solve only needs b gathered from its edges followed by a
+*     forward and a back substitution. Grids solved together are interleaved
+*     so the substitutions stream through L once for the whole batch, and the
+*     batch is shared between the workers of the pool
+*
+* - only batches run in parallel, each grid's substitutions being done by a
+*   single worker. Every unknown of a substitution depends on the one before
+*   it, and splitting the band update of one grid between the workers would
+*   need a barrier every few unknowns, which costs more than the update, so a
+*   single grid is solved sequentially
+*
+* The factor holds (rows-2)^2 * (cols-1) values, so this suits grids of up to a
+* few hundred cells per side, where it beats thousands of relaxation sweeps.
+* Larger grids, above BANDED_MAX_SIZE, fall back to relaxation.
+*
+**/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "relaxation_technique.h"
+
+// identifies factor files, changed whenever their layout changes
+#define BANDED_FILE_MAGIC "RLXBAND1"
+
+// factors already built or loaded during this run
+BANDED_FACTOR* factor_cache = NULL;
+
+// state shared with the pool tasks of one batch of solves
+typedef struct banded_solve {
+    BANDED_FACTOR* factor;
+    double** grids;
+    int grid_count;
+} BANDED_SOLVE;
+
+// Returns 1 if the current problem suits the banded solver
+int bandedQualifies() {
+    return matrix_size >= 3 && matrix_size <= BANDED_MAX_SIZE;
+}
+
+// Computes the banded Cholesky factor of the 5-point matrix of the interior of
+// a rows*cols grid. Row i of L is stored at band[i*(bandwidth+1)], its entry
+// for column j (i-bandwidth <= j <= i) at offset j-i+bandwidth.
+void factorise5Point(BANDED_FACTOR* factor) {
+    long unknowns = factor->unknowns;
+    int bandwidth = factor->bandwidth;
+    int width = bandwidth + 1;
+    double* band = factor->band;
+
+    for (long i=0 ; i<unknowns ; i++) {
+        double* row_i = &band[i*width];
+        long first = i - bandwidth < 0 ? 0 : i - bandwidth;
+
+        for (long j=first ; j<=i ; j++) {
+            double* row_j = &band[j*width];
+
+            // entry of A, 4 on the diagonal and -1 for the cell to the left
+            // (unless it is on the previous row) and the cell above
+            double sum = 0.0;
+            if (j == i) {
+                sum = 4.0;
+            } else if ((j == i - 1 && i%bandwidth != 0) || j == i - bandwidth) {
+                sum = -1.0;
+            }
+
+            // subtract the dot product of rows i and j of L over the columns
+            // they share, which are contiguous in both rows
+            long k_first = first > j - bandwidth ? first : j - bandwidth;
+            double* l_i = &row_i[k_first - i + bandwidth];
+            double* l_j = &row_j[k_first - j + bandwidth];
+            for (long k=0 ; k<j-k_first ; k++) {
+                sum -= l_i[k]*l_j[k];
+            }
+
+            if (j == i) {
+                row_i[bandwidth] = sqrt(sum);
+            } else {
+                row_i[j - i + bandwidth] = sum/row_j[bandwidth];
+            }
+        }
+    }
+}
+
+// Returns the path of the factor file for a grid shape in cache_directory
+void getFactorPath(char* path, int length, char* cache_directory, int rows, int cols) {
+    snprintf(path, length, "%s/banded_%dx%d.bin", cache_directory, rows, cols);
+}
+
+// Reads a factor from the disk cache, returns NULL if it isn't there or
+// doesn't match the grid shape
+BANDED_FACTOR* readFactor(char* cache_directory, int rows, int cols) {
+    char path[4096];
+    getFactorPath(path, sizeof(path), cache_directory, rows, cols);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    char magic[8];
+    int shape[2];
+    BANDED_FACTOR* factor = NULL;
+
+    if (fread(magic, 1, 8, file) == 8 && memcmp(magic, BANDED_FILE_MAGIC, 8) == 0
+            && fread(shape, sizeof(int), 2, file) == 2 && shape[0] == rows && shape[1] == cols) {
+        factor = malloc(sizeof(BANDED_FACTOR));
+        factor->rows = rows;
+        factor->cols = cols;
+        factor->bandwidth = cols - 2;
+        factor->unknowns = (long)(rows - 2)*(cols - 2);
+
+        long count = factor->unknowns*(factor->bandwidth + 1);
+        factor->band = malloc(count*sizeof(double));
+        if (factor->band == NULL || fread(factor->band, sizeof(double), count, file) != (size_t)count) {
+            free(factor->band);
+            free(factor);
+            factor = NULL;
+        }
+    }
+
+    fclose(file);
+    return factor;
+}
+
+// Writes a factor to the disk cache, creating the directory if needed
+void writeFactor(char* cache_directory, BANDED_FACTOR* factor) {
+    if (mkdir(cache_directory, 0755) != 0 && errno != EEXIST) {
+        printf("Could not create cache directory '%s'\n", cache_directory);
+        return;
+    }
+
+    char path[4096];
+    getFactorPath(path, sizeof(path), cache_directory, factor->rows, factor->cols);
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Could not open '%s' for writing\n", path);
+        return;
+    }
+
+    int shape[2] = {factor->rows, factor->cols};
+    fwrite(BANDED_FILE_MAGIC, 1, 8, file);
+    fwrite(shape, sizeof(int), 2, file);
+    fwrite(factor->band, sizeof(double), factor->unknowns*(factor->bandwidth + 1), file);
+    fclose(file);
+}
+
+// Returns the factor for a rows*cols grid, from the memory cache, the disk
+// cache in cache_directory (may be NULL) or by factorising, or NULL if there
+// isn't the memory to hold it
+BANDED_FACTOR* getBandedFactor(int rows, int cols, char* cache_directory) {
+    for (BANDED_FACTOR* factor=factor_cache ; factor!=NULL ; factor=factor->next) {
+        if (factor->rows == rows && factor->cols == cols) {
+            return factor;
+        }
+    }
+
+    BANDED_FACTOR* factor = NULL;
+    if (cache_directory != NULL) {
+        factor = readFactor(cache_directory, rows, cols);
+    }
+
+    if (factor == NULL) {
+        factor = malloc(sizeof(BANDED_FACTOR));
+        factor->rows = rows;
+        factor->cols = cols;
+        factor->bandwidth = cols - 2;
+        factor->unknowns = (long)(rows - 2)*(cols - 2);
+        factor->band = malloc(factor->unknowns*(factor->bandwidth + 1)*sizeof(double));
+        if (factor->band == NULL) {
+            printf("Not enough memory for the banded factor of a %dx%d grid\n", rows, cols);
+            free(factor);
+            return NULL;
+        }
+        factorise5Point(factor);
+
+        if (cache_directory != NULL) {
+            writeFactor(cache_directory, factor);
+        }
+    }
+
+    factor->next = factor_cache;
+    factor_cache = factor;
+    return factor;
+}
+
+// Frees every factor in the memory cache
+void freeBandedFactors() {
+    while (factor_cache != NULL) {
+        BANDED_FACTOR* next = factor_cache->next;
+        free(factor_cache->band);
+        free(factor_cache);
+        factor_cache = next;
+    }
+}
+
+// Pool task, each worker gathers, substitutes and scatters its share of the
+// batch. The worker's grids are interleaved in its own buffer, unknown i of
+// grid start+g at values[i*stride + g], and the loops over them are innermost
+// so one pass over L serves all of them.
+void substitutionTask(int worker, int worker_count, void* arg) {
+    BANDED_SOLVE* solve = (BANDED_SOLVE*)arg;
+    BANDED_FACTOR* factor = solve->factor;
+    int cols = factor->cols;
+    int inner_rows = factor->rows - 2;
+    int inner_cols = cols - 2;
+    int bandwidth = factor->bandwidth;
+    int width = bandwidth + 1;
+
+    long start, end;
+    splitRange(worker, worker_count, solve->grid_count, &start, &end);
+    if (start == end) {
+        return;
+    }
+
+    long stride = end - start;
+    double* values = malloc(factor->unknowns*stride*sizeof(double));
+
+    // right hand side, the edge cells next to each unknown
+    for (long g=0 ; g<stride ; g++) {
+        double* grid = solve->grids[start + g];
+        for (long r=0 ; r<inner_rows ; r++) {
+            for (long c=0 ; c<inner_cols ; c++) {
+                double sum = 0.0;
+                if (r == 0) {
+                    sum += grid[c + 1];
+                }
+                if (r == inner_rows - 1) {
+                    sum += grid[(r + 2)*cols + c + 1];
+                }
+                if (c == 0) {
+                    sum += grid[(r + 1)*cols];
+                }
+                if (c == inner_cols - 1) {
+                    sum += grid[(r + 1)*cols + cols - 1];
+                }
+                values[(r*inner_cols + c)*stride + g] = sum;
+            }
+        }
+    }
+
+    // forward substitution, L y = b
+    for (long i=0 ; i<factor->unknowns ; i++) {
+        double* row = &factor->band[i*width];
+        double* y_i = &values[i*stride];
+        long first = i - bandwidth < 0 ? 0 : i - bandwidth;
+
+        for (long j=first ; j<i ; j++) {
+            double l = row[j - i + bandwidth];
+            double* y_j = &values[j*stride];
+            for (long g=0 ; g<stride ; g++) {
+                y_i[g] -= l*y_j[g];
+            }
+        }
+        for (long g=0 ; g<stride ; g++) {
+            y_i[g] /= row[bandwidth];
+        }
+    }
+
+    // back substitution, L^T x = y, by rows of L so they are read contiguously
+    for (long i=factor->unknowns-1 ; i>=0 ; i--) {
+        double* row = &factor->band[i*width];
+        double* x_i = &values[i*stride];
+        long first = i - bandwidth < 0 ? 0 : i - bandwidth;
+
+        for (long g=0 ; g<stride ; g++) {
+            x_i[g] /= row[bandwidth];
+        }
+        for (long j=first ; j<i ; j++) {
+            double l = row[j - i + bandwidth];
+            double* x_j = &values[j*stride];
+            for (long g=0 ; g<stride ; g++) {
+                x_j[g] -= l*x_i[g];
+            }
+        }
+    }
+
+    for (long g=0 ; g<stride ; g++) {
+        double* grid = solve->grids[start + g];
+        for (long r=0 ; r<inner_rows ; r++) {
+            for (long c=0 ; c<inner_cols ; c++) {
+                grid[(r + 1)*cols + c + 1] = values[(r*inner_cols + c)*stride + g];
+            }
+        }
+    }
+
+    free(values);
+}
+
+// Overwrites the interior of each of the grid_count grids, which all have the
+// shape the factor was built for, with the exact solution of the discrete
+// Laplace problem set by its edge cells. The grids are split between the
+// workers, so at most grid_count of them take part. Must be called with the
+// pool started.
+void solveBanded(BANDED_FACTOR* factor, double** grids, int grid_count) {
+    BANDED_SOLVE solve;
+    solve.factor = factor;
+    solve.grids = grids;
+    solve.grid_count = grid_count;
+
+    runPool(substitutionTask, &solve);
+}
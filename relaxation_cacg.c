@@ -0,0 +1,361 @@
+/**
+* Communication-avoiding s-step conjugate gradient solver
+* Oliver Redeyoff
+*
+* The interior cells solve A u = b, with A u = 4u - (sum of the 4 neighbours)
+* and b the contribution of the edge cells. A is symmetric positive definite,
+* so conjugate gradients converge in far fewer steps than relaxation, but
+* each step needs 2 global dot products and a matrix product that reads the
+* neighbouring workers' rows, 3 meetings of every thread per step. This
+* solver takes s steps per outer iteration with 2 meetings:
+*
+* 1 - each worker builds the basis Y = [P, R] of its strip of rows, where P
+*     is p, A p, ..., A^s p and R is r, A r, ..., A^(s-1) r written in a
+*     polynomial basis. The strip's A^j p needs p on the rows within j of it,
+*     so the worker reads p and r on s extra rows on either side and computes
+*     the powers on a shrinking range (a halo of depth s) without meeting the
+*     others. It then adds up its share of the Gram matrix G = Y^T Y
+*
+* 2 - the calling thread sums the shares, the one blocked reduction of the
+*     outer iteration, and runs s steps of conjugate gradients on the
+*     coordinates of x, r and p in the basis. A applied to a basis vector is
+*     a known combination of the next ones, and every dot product is taken
+*     through G, so these steps don't touch the matrix
+*
+* 3 - each worker turns the coordinates back into the new x, r and p on its
+*     strip
+*
+* The powers of A quickly become parallel in the monomial basis, so the basis
+* is the Chebyshev polynomials of A scaled to its spectrum, which is known
+* for the square grid, and the basis vectors stay well conditioned. The outer
+* iterations stop when one changes no cell by more than decimal_value.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// largest number of steps per outer iteration, past it the basis loses too
+// much precision even in the Chebyshev basis
+#define CACG_MAX_STEPS 16
+
+// a worker's strip and basis, aligned so that workers don't share cache lines
+typedef struct cacg_worker {
+    long owned_start;       // first global row of the worker's strip
+    long owned_end;         // row after its last one
+    long first_row;         // global row of buffer row 0
+    long rows;              // buffer rows, strip plus both halos
+    double* basis;          // the 2s+1 basis vectors on the buffer rows
+    double* gram;           // the worker's share of G
+} __attribute__((aligned(64))) CACG_WORKER;
+
+// state shared with the pool tasks of one solve
+typedef struct cacg_solve {
+    double* grid;           // holds x in its interior
+    long size;
+    int steps;              // s
+    int dimension;          // 2s+1, P is vectors 0..s and R is s+1..2s
+    double centre;          // A's spectrum is centre +- radius
+    double radius;
+    double* residual;       // r, 0 on the edges
+    double* direction;      // p, 0 on the edges
+    double* x_coordinates;  // coordinates of the change of x in the basis
+    double* r_coordinates;  // and of the new r and p
+    double* p_coordinates;
+    CACG_WORKER* workers;
+    int changed;
+} CACG_SOLVE;
+
+// Pool task, the first residual and direction on the worker's strip
+void cacgInitTask(int worker, int worker_count, void* arg) {
+    CACG_SOLVE* solve = (CACG_SOLVE*)arg;
+    CACG_WORKER* strip = &solve->workers[worker];
+    long n = solve->size;
+
+    for (long i=strip->owned_start ; i<strip->owned_end ; i++) {
+        for (long j=1 ; j<n-1 ; j++) {
+            long k = i*n + j;
+            double* grid = solve->grid;
+            double residual = grid[k - n] + grid[k + 1] + grid[k + n] + grid[k - 1] - 4*grid[k];
+            solve->residual[k] = residual;
+            solve->direction[k] = residual;
+        }
+    }
+}
+
+// Fills the Chebyshev basis of v, vectors first to first+count-1 of the
+// worker's buffer, the first one being v itself copied over the whole buffer
+void buildChebyshevBasis(CACG_SOLVE* solve, CACG_WORKER* strip, double* v, int first, int count) {
+    long n = solve->size;
+    long plane = strip->rows*n;
+    double centre = solve->centre;
+    double radius = solve->radius;
+
+    memcpy(&strip->basis[first*plane], &v[strip->first_row*n], plane*sizeof(double));
+
+    for (int j=1 ; j<count ; j++) {
+        // rows where vector j is needed, the strip plus s-j halo rows
+        long halo = solve->steps - j;
+        long start = strip->owned_start - halo < 1 ? 1 : strip->owned_start - halo;
+        long end = strip->owned_end + halo > n - 1 ? n - 1 : strip->owned_end + halo;
+        double* previous = &strip->basis[(first + j - 1)*plane];
+        double* before = j > 1 ? &strip->basis[(first + j - 2)*plane] : NULL;
+        double* out = &strip->basis[(first + j)*plane];
+
+        // T1 = (A - centre)/radius T0, T(j+1) = 2 (A - centre)/radius Tj - T(j-1)
+        for (long i=start ; i<end ; i++) {
+            for (long c=1 ; c<n-1 ; c++) {
+                long k = (i - strip->first_row)*n + c;
+                double product = 4*previous[k] - previous[k - n] - previous[k + 1] - previous[k + n] - previous[k - 1];
+                double shifted = (product - centre*previous[k])/radius;
+                out[k] = before == NULL ? shifted : 2*shifted - before[k];
+            }
+        }
+    }
+}
+
+// Pool task, the basis and the share of the Gram matrix of the worker's strip
+void cacgBasisTask(int worker, int worker_count, void* arg) {
+    CACG_SOLVE* solve = (CACG_SOLVE*)arg;
+    CACG_WORKER* strip = &solve->workers[worker];
+    long n = solve->size;
+    int s = solve->steps;
+    int dimension = solve->dimension;
+    long plane = strip->rows*n;
+    memset(strip->gram, 0, dimension*dimension*sizeof(double));
+    if (strip->owned_start == strip->owned_end) {
+        return;
+    }
+
+    // first touch by the worker that uses it, the edge cells stay 0
+    if (strip->basis == NULL) {
+        strip->basis = calloc(dimension*plane, sizeof(double));
+    }
+
+    buildChebyshevBasis(solve, strip, solve->direction, 0, s + 1);
+    buildChebyshevBasis(solve, strip, solve->residual, s + 1, s);
+
+    // row by row, so the row of every basis vector stays in the cache while
+    // all the products are taken
+    for (long i=strip->owned_start ; i<strip->owned_end ; i++) {
+        long row = (i - strip->first_row)*n;
+        for (int a=0 ; a<dimension ; a++) {
+            double* u = &strip->basis[a*plane + row];
+            for (int b=a ; b<dimension ; b++) {
+                double* v = &strip->basis[b*plane + row];
+                double sum = 0.0;
+                for (long j=1 ; j<n-1 ; j++) {
+                    sum += u[j]*v[j];
+                }
+                strip->gram[a*dimension + b] += sum;
+            }
+        }
+    }
+    for (int a=0 ; a<dimension ; a++) {
+        for (int b=0 ; b<a ; b++) {
+            strip->gram[a*dimension + b] = strip->gram[b*dimension + a];
+        }
+    }
+}
+
+// Pool task, turns the coordinates back into x, r and p on the worker's strip
+void cacgUpdateTask(int worker, int worker_count, void* arg) {
+    CACG_SOLVE* solve = (CACG_SOLVE*)arg;
+    CACG_WORKER* strip = &solve->workers[worker];
+    long n = solve->size;
+    int dimension = solve->dimension;
+    long plane = strip->rows*n;
+    double threshold = decimal_value;
+    int changed = 0;
+
+    for (long i=strip->owned_start ; i<strip->owned_end ; i++) {
+        long row = (i - strip->first_row)*n;
+        double* x = &solve->grid[i*n];
+        double* residual = &solve->residual[i*n];
+        double* direction = &solve->direction[i*n];
+
+        // the change of x is built in the direction's row, which is
+        // rebuilt after, the basis holds its own copy of the old values
+        for (long j=1 ; j<n-1 ; j++) {
+            direction[j] = 0.0;
+        }
+        for (int a=0 ; a<dimension ; a++) {
+            double* v = &strip->basis[a*plane + row];
+            double coordinate = solve->x_coordinates[a];
+            for (long j=1 ; j<n-1 ; j++) {
+                direction[j] += coordinate*v[j];
+            }
+        }
+        for (long j=1 ; j<n-1 ; j++) {
+            changed |= fabs(direction[j]) > threshold;
+            x[j] += direction[j];
+            residual[j] = 0.0;
+            direction[j] = 0.0;
+        }
+        for (int a=0 ; a<dimension ; a++) {
+            double* v = &strip->basis[a*plane + row];
+            double r_coordinate = solve->r_coordinates[a];
+            double p_coordinate = solve->p_coordinates[a];
+            for (long j=1 ; j<n-1 ; j++) {
+                residual[j] += r_coordinate*v[j];
+                direction[j] += p_coordinate*v[j];
+            }
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Sets out to the coordinates of A times the vector with coordinates in, for
+// vectors in the span of the basis vectors whose product is in the basis
+void applyBasisChange(CACG_SOLVE* solve, double* in, double* out) {
+    int s = solve->steps;
+    double centre = solve->centre;
+    double radius = solve->radius;
+    memset(out, 0, solve->dimension*sizeof(double));
+
+    // A T0 = centre T0 + radius T1, A Tj = radius/2 T(j-1) + centre Tj + radius/2 T(j+1)
+    for (int block=0 ; block<2 ; block++) {
+        int first = block == 0 ? 0 : s + 1;
+        int count = block == 0 ? s : s - 1;
+        for (int j=0 ; j<count ; j++) {
+            double value = in[first + j];
+            out[first + j] += centre*value;
+            if (j == 0) {
+                out[first + 1] += radius*value;
+            } else {
+                out[first + j - 1] += radius/2*value;
+                out[first + j + 1] += radius/2*value;
+            }
+        }
+    }
+}
+
+// Returns u^T G v for coordinates u and v
+double gramProduct(double* gram, int dimension, double* u, double* v) {
+    double sum = 0.0;
+    for (int a=0 ; a<dimension ; a++) {
+        for (int b=0 ; b<dimension ; b++) {
+            sum += u[a]*gram[a*dimension + b]*v[b];
+        }
+    }
+    return sum;
+}
+
+// Runs up to s conjugate gradient steps on the coordinates, stopping early if
+// the residual vanishes or the basis has lost too much precision for the
+// step to be meaningful
+void runCoordinateSteps(CACG_SOLVE* solve, double* gram) {
+    int dimension = solve->dimension;
+    double* x = solve->x_coordinates;
+    double* r = solve->r_coordinates;
+    double* p = solve->p_coordinates;
+    double product[2*CACG_MAX_STEPS + 1];
+
+    memset(x, 0, dimension*sizeof(double));
+    memset(r, 0, dimension*sizeof(double));
+    memset(p, 0, dimension*sizeof(double));
+    r[solve->steps + 1] = 1.0;
+    p[0] = 1.0;
+
+    double r_norm = gramProduct(gram, dimension, r, r);
+    for (int step=0 ; step<solve->steps ; step++) {
+        applyBasisChange(solve, p, product);
+        double curvature = gramProduct(gram, dimension, p, product);
+        if (!(r_norm > 0) || !(curvature > 0)) {
+            return;
+        }
+
+        double alpha = r_norm/curvature;
+        for (int a=0 ; a<dimension ; a++) {
+            x[a] += alpha*p[a];
+            r[a] -= alpha*product[a];
+        }
+
+        double new_r_norm = gramProduct(gram, dimension, r, r);
+        double beta = new_r_norm/r_norm;
+        for (int a=0 ; a<dimension ; a++) {
+            p[a] = r[a] + beta*p[a];
+        }
+        r_norm = new_r_norm;
+    }
+}
+
+// Solves grid, a size*size matrix, with s-step conjugate gradients, steps
+// steps per outer iteration, until an outer iteration changes no value by
+// more than decimal_value. Must be called with the pool started.
+void relaxCacg(double* grid, int size, int steps, int worker_count) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+    int s = steps < 1 ? 1 : steps > CACG_MAX_STEPS ? CACG_MAX_STEPS : steps;
+
+    CACG_SOLVE solve;
+    solve.grid = grid;
+    solve.size = n;
+    solve.steps = s;
+    solve.dimension = 2*s + 1;
+    solve.changed = 0;
+
+    // eigenvalues of A are 4 - 2cos(k pi/(N+1)) - 2cos(l pi/(N+1))
+    solve.centre = 4;
+    solve.radius = 4*cos(M_PI/(n - 1));
+
+    solve.residual = calloc(n*n, sizeof(double));
+    solve.direction = calloc(n*n, sizeof(double));
+    solve.x_coordinates = malloc(solve.dimension*sizeof(double));
+    solve.r_coordinates = malloc(solve.dimension*sizeof(double));
+    solve.p_coordinates = malloc(solve.dimension*sizeof(double));
+    double* gram = malloc(solve.dimension*solve.dimension*sizeof(double));
+
+    solve.workers = aligned_alloc(64, worker_count*sizeof(CACG_WORKER));
+    for (int w=0 ; w<worker_count ; w++) {
+        CACG_WORKER* strip = &solve.workers[w];
+        long start, end;
+        splitRange(w, worker_count, n - 2, &start, &end);
+        strip->owned_start = start + 1;
+        strip->owned_end = end + 1;
+        strip->first_row = strip->owned_start - s < 0 ? 0 : strip->owned_start - s;
+        strip->rows = (strip->owned_end + s > n ? n : strip->owned_end + s) - strip->first_row;
+        strip->basis = NULL;
+        strip->gram = malloc(solve.dimension*solve.dimension*sizeof(double));
+    }
+
+    runPool(cacgInitTask, &solve);
+
+    while (1) {
+        runPool(cacgBasisTask, &solve);
+
+        memset(gram, 0, solve.dimension*solve.dimension*sizeof(double));
+        for (int w=0 ; w<worker_count ; w++) {
+            for (int k=0 ; k<solve.dimension*solve.dimension ; k++) {
+                gram[k] += solve.workers[w].gram[k];
+            }
+        }
+        runCoordinateSteps(&solve, gram);
+
+        runPool(cacgUpdateTask, &solve);
+        if (!solve.changed) {
+            break;
+        }
+        solve.changed = 0;
+    }
+
+    for (int w=0 ; w<worker_count ; w++) {
+        free(solve.workers[w].basis);
+        free(solve.workers[w].gram);
+    }
+    free(solve.workers);
+    free(solve.residual);
+    free(solve.direction);
+    free(solve.x_coordinates);
+    free(solve.r_coordinates);
+    free(solve.p_coordinates);
+    free(gram);
+}
@@ -0,0 +1,470 @@
+/**
+* Fast direct solver for rectangular Dirichlet problems
+* Oliver Redeyoff
+*
+* The cells that relaxation converges to satisfy 4u(i,j) - (sum of the four
+* neighbours) = 0, which for the interior of a rectangle with fixed edges is the
+* linear system A u = b, where b holds the contribution of the edge cells. The
+* eigenvectors of the horizontal part of A are sine waves, so a discrete sine
+* transform (DST-I) along the rows decouples the system into one tridiagonal
+* system per wave number and the exact solution is found with no iterations:
+*
+* 1 - gather b from the edges and apply the DST along each row
+*
+* 2 - solve the tridiagonal system down each column with the Thomas
+*     algorithm, for all the columns of a worker at once
+*
+* 3 - apply the DST along each row again and scale, which gives the interior
+*     of the solution
+*
+* The DST is computed with a self-contained mixed radix FFT of the odd
+* extension of each row, two rows per complex FFT, falling back to Bluestein's
+* algorithm when the length has a large prime factor, so the whole solve is
+* O(N^2 log N). Rows are shared between the workers of the pool.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include "relaxation_technique.h"
+
+// largest prime factor handled directly by the FFT, lengths with bigger ones
+// go through Bluestein's algorithm
+#define MAX_DIRECT_FACTOR 31
+
+// precomputed data for the DST of rows of a given length
+typedef struct dst_plan {
+    int length;         // number of values transformed
+    int fft_length;     // length of the FFTs performed
+    int bluestein;      // 1 if 2*(length+1) has a prime factor too big for the FFT
+    int factors[32];
+    int factor_count;
+    double complex* roots;  // exp(-2 pi i k / fft_length)
+    double complex* chirp;
+    double complex* chirp_filter;
+} DST_PLAN;
+
+// state shared with the pool tasks of one solve
+typedef struct dst_solve {
+    double* grid;
+    int rows;
+    int cols;
+    double* buffer;     // interior values, (rows-2)*(cols-2)
+    double* factors;    // Thomas algorithm coefficients, same size
+    DST_PLAN* plan;     // DST along a row of the interior
+    double* eigenvalues;
+} DST_SOLVE;
+
+// Complex product written out, so that it compiles to plain arithmetic instead
+// of the library call C99 requires for infinities
+static inline double complex cmul(double complex a, double complex b) {
+    return CMPLX(creal(a)*creal(b) - cimag(a)*cimag(b), creal(a)*cimag(b) + cimag(a)*creal(b));
+}
+
+// Returns smallest power of two greater or equal to n
+int nextPowerOfTwo(int n) {
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// Splits n into factors, fours first then primes in increasing order. Returns
+// the largest prime factor.
+int factorise(int n, int* factors, int* factor_count) {
+    int largest = 1;
+    *factor_count = 0;
+
+    while (n%4 == 0) {
+        factors[(*factor_count)++] = 4;
+        n /= 4;
+        largest = 2;
+    }
+    for (int p=2 ; n>1 ; p++) {
+        while (n%p == 0) {
+            factors[(*factor_count)++] = p;
+            n /= p;
+            largest = p;
+        }
+    }
+    return largest;
+}
+
+// Self-sorting (Stockham) mixed radix FFT of the plan->fft_length values in
+// data, scratch must hold as many values. Each stage with radix p splits the
+// remaining length n into p interleaved transforms of length n/p, the inner
+// loop runs over the stride s so it reads and writes contiguous values.
+void fft(DST_PLAN* plan, double complex* data, double complex* scratch) {
+    int total = plan->fft_length;
+    double complex* x = data;
+    double complex* y = scratch;
+    double complex a[MAX_DIRECT_FACTOR];
+
+    for (int f=0, n=total, s=1 ; f<plan->factor_count ; f++) {
+        int p = plan->factors[f];
+        int m = n/p;
+        int root_step = total/n;
+
+        // p point DFTs, each output k twiddled by exp(-2 pi i j k / n), with
+        // the common radices written out so the inner loop vectorises
+        if (p == 2) {
+            for (int j=0 ; j<m ; j++) {
+                double complex w = plan->roots[j*root_step];
+                double complex* in = &x[s*j];
+                double complex* out = &y[s*2*j];
+                for (int q=0 ; q<s ; q++) {
+                    double complex a0 = in[q];
+                    double complex a1 = in[q + s*m];
+                    out[q] = a0 + a1;
+                    out[q + s] = cmul(a0 - a1, w);
+                }
+            }
+        } else if (p == 4) {
+            for (int j=0 ; j<m ; j++) {
+                double complex w1 = plan->roots[j*root_step];
+                double complex w2 = plan->roots[2*j*root_step];
+                double complex w3 = plan->roots[3*j*root_step];
+                double complex* in = &x[s*j];
+                double complex* out = &y[s*4*j];
+                for (int q=0 ; q<s ; q++) {
+                    double complex a0 = in[q];
+                    double complex a1 = in[q + s*m];
+                    double complex a2 = in[q + 2*s*m];
+                    double complex a3 = in[q + 3*s*m];
+                    double complex sum_02 = a0 + a2;
+                    double complex diff_02 = a0 - a2;
+                    double complex sum_13 = a1 + a3;
+                    double complex diff_13 = a1 - a3;
+                    double complex rotated = CMPLX(cimag(diff_13), -creal(diff_13));
+                    out[q] = sum_02 + sum_13;
+                    out[q + s] = cmul(diff_02 + rotated, w1);
+                    out[q + 2*s] = cmul(sum_02 - sum_13, w2);
+                    out[q + 3*s] = cmul(diff_02 - rotated, w3);
+                }
+            }
+        } else if (p == 3) {
+            // exp(-2 pi i / 3) = -1/2 - i sqrt(3)/2
+            double sin_60 = sqrt(3.0)/2.0;
+            for (int j=0 ; j<m ; j++) {
+                double complex w1 = plan->roots[j*root_step];
+                double complex w2 = plan->roots[2*j*root_step];
+                double complex* in = &x[s*j];
+                double complex* out = &y[s*3*j];
+                for (int q=0 ; q<s ; q++) {
+                    double complex a0 = in[q];
+                    double complex a1 = in[q + s*m];
+                    double complex a2 = in[q + 2*s*m];
+                    double complex sum_12 = a1 + a2;
+                    double complex diff_12 = a1 - a2;
+                    double complex middle = a0 - 0.5*sum_12;
+                    double complex rotated = CMPLX(sin_60*cimag(diff_12), -sin_60*creal(diff_12));
+                    out[q] = a0 + sum_12;
+                    out[q + s] = cmul(middle + rotated, w1);
+                    out[q + 2*s] = cmul(middle - rotated, w2);
+                }
+            }
+        } else {
+            // any other prime, as a p*p matrix product
+            double complex dft[MAX_DIRECT_FACTOR*MAX_DIRECT_FACTOR];
+            double complex twiddles[MAX_DIRECT_FACTOR];
+            for (int k=0 ; k<p ; k++) {
+                for (int r=0 ; r<p ; r++) {
+                    dft[k*p + r] = plan->roots[(r*k%p)*(total/p)];
+                }
+            }
+
+            for (int j=0 ; j<m ; j++) {
+                for (int k=0 ; k<p ; k++) {
+                    twiddles[k] = plan->roots[j*k*root_step];
+                }
+                for (int q=0 ; q<s ; q++) {
+                    for (int r=0 ; r<p ; r++) {
+                        a[r] = x[q + s*(j + r*m)];
+                    }
+                    double complex* out = &y[q + s*p*j];
+                    for (int k=0 ; k<p ; k++) {
+                        double complex sum = a[0];
+                        for (int r=1 ; r<p ; r++) {
+                            sum += cmul(a[r], dft[k*p + r]);
+                        }
+                        out[k*s] = cmul(sum, twiddles[k]);
+                    }
+                }
+            }
+        }
+
+        double complex* swap = x;
+        x = y;
+        y = swap;
+        n = m;
+        s *= p;
+    }
+
+    if (x != data) {
+        memcpy(data, x, total*sizeof(double complex));
+    }
+}
+
+// Returns a plan for the DST of rows of the given length
+DST_PLAN* makeDstPlan(int length) {
+    DST_PLAN* plan = malloc(sizeof(DST_PLAN));
+    int n = 2*(length + 1);
+
+    plan->length = length;
+    plan->bluestein = factorise(n, plan->factors, &plan->factor_count) > MAX_DIRECT_FACTOR;
+    plan->fft_length = n;
+    if (plan->bluestein) {
+        plan->fft_length = nextPowerOfTwo(2*n - 1);
+        factorise(plan->fft_length, plan->factors, &plan->factor_count);
+    }
+
+    int m = plan->fft_length;
+    plan->roots = malloc(m*sizeof(double complex));
+    for (int k=0 ; k<m ; k++) {
+        plan->roots[k] = cexp(-2.0*M_PI*I*k/m);
+    }
+
+    plan->chirp = NULL;
+    plan->chirp_filter = NULL;
+    if (plan->bluestein) {
+        // chirp w(k) = exp(-i pi k^2 / n), k^2 is reduced mod 2n to keep the
+        // angle accurate for large k
+        plan->chirp = malloc(n*sizeof(double complex));
+        for (long k=0 ; k<n ; k++) {
+            plan->chirp[k] = cexp(-M_PI*I*(double)((k*k)%(2*n))/n);
+        }
+
+        plan->chirp_filter = calloc(m, sizeof(double complex));
+        plan->chirp_filter[0] = conj(plan->chirp[0]);
+        for (int k=1 ; k<n ; k++) {
+            plan->chirp_filter[k] = conj(plan->chirp[k]);
+            plan->chirp_filter[m - k] = conj(plan->chirp[k]);
+        }
+        double complex* scratch = malloc(m*sizeof(double complex));
+        fft(plan, plan->chirp_filter, scratch);
+        free(scratch);
+    }
+
+    return plan;
+}
+
+void freeDstPlan(DST_PLAN* plan) {
+    free(plan->roots);
+    free(plan->chirp);
+    free(plan->chirp_filter);
+    free(plan);
+}
+
+// Number of complex values of scratch space dst needs
+int dstWorkSize(DST_PLAN* plan) {
+    return 2*plan->fft_length;
+}
+
+// Replaces the values of two rows with their unnormalised DST-I, the second
+// row may be NULL. work must hold dstWorkSize(plan) values.
+void dst(DST_PLAN* plan, double* row_a, double* row_b, double complex* work) {
+    int length = plan->length;
+    int n = 2*(length + 1);
+    double complex* input = work;
+    double complex* output = work + plan->fft_length; // only used as scratch
+
+    // odd extension of both rows, row a as real part and row b as imaginary
+    // part. The FFT of a real odd sequence is -2i times its DST, so the
+    // transform of a comes out as the imaginary part and b as the real part.
+    memset(input, 0, plan->fft_length*sizeof(double complex));
+    for (int k=0 ; k<length ; k++) {
+        double b = row_b == NULL ? 0.0 : row_b[k];
+        input[k + 1] = CMPLX(row_a[k], b);
+        input[n - k - 1] = CMPLX(-row_a[k], -b);
+    }
+
+    if (plan->bluestein) {
+        // X(k) = w(k) * sum x(j) w(j) conj(w(k-j)), a convolution done with
+        // FFTs of the padded length, the inverse one through conjugation
+        for (int k=0 ; k<n ; k++) {
+            input[k] = cmul(input[k], plan->chirp[k]);
+        }
+        fft(plan, input, output);
+        for (int k=0 ; k<plan->fft_length ; k++) {
+            input[k] = conj(cmul(input[k], plan->chirp_filter[k]));
+        }
+        fft(plan, input, output);
+        for (int k=0 ; k<n ; k++) {
+            input[k] = cmul(conj(input[k]), plan->chirp[k])/plan->fft_length;
+        }
+    } else {
+        fft(plan, input, output);
+    }
+
+    for (int k=0 ; k<length ; k++) {
+        row_a[k] = -0.5*cimag(input[k + 1]);
+        if (row_b != NULL) {
+            row_b[k] = 0.5*creal(input[k + 1]);
+        }
+    }
+}
+
+// Pool task, fills the buffer with the right hand side b and applies the DST
+// along each of its rows
+void forwardTask(int worker, int worker_count, void* arg) {
+    DST_SOLVE* solve = (DST_SOLVE*)arg;
+    int cols = solve->cols;
+    int inner_rows = solve->rows - 2;
+    int inner_cols = cols - 2;
+
+    long start, end;
+    splitRange(worker, worker_count, inner_rows, &start, &end);
+
+    for (long r=start ; r<end ; r++) {
+        double* row = &solve->buffer[r*inner_cols];
+        double* above = &solve->grid[r*cols + 1];
+        double* below = &solve->grid[(r + 2)*cols + 1];
+
+        for (int c=0 ; c<inner_cols ; c++) {
+            row[c] = 0.0;
+        }
+        if (r == 0) {
+            for (int c=0 ; c<inner_cols ; c++) {
+                row[c] += above[c];
+            }
+        }
+        if (r == inner_rows - 1) {
+            for (int c=0 ; c<inner_cols ; c++) {
+                row[c] += below[c];
+            }
+        }
+        row[0] += solve->grid[(r + 1)*cols];
+        row[inner_cols - 1] += solve->grid[(r + 1)*cols + cols - 1];
+    }
+
+    double complex* work = malloc(dstWorkSize(solve->plan)*sizeof(double complex));
+    for (long r=start ; r<end ; r+=2) {
+        double* row_a = &solve->buffer[r*inner_cols];
+        dst(solve->plan, row_a, r+1 < end ? row_a + inner_cols : NULL, work);
+    }
+    free(work);
+}
+
+// Pool task, solves the tridiagonal system of each column of coefficients with
+// the Thomas algorithm. Column k satisfies (2 + eigenvalue k) u(r) - u(r-1) -
+// u(r+1) = b(r), the workers share the columns and sweep down then up the
+// rows so the inner loop runs along a row.
+void tridiagonalTask(int worker, int worker_count, void* arg) {
+    DST_SOLVE* solve = (DST_SOLVE*)arg;
+    int inner_rows = solve->rows - 2;
+    int inner_cols = solve->cols - 2;
+    double* values = solve->buffer;
+    double* factors = solve->factors;
+
+    long start, end;
+    splitRange(worker, worker_count, inner_cols, &start, &end);
+
+    // forward elimination, factors holds the modified upper diagonal
+    for (long k=start ; k<end ; k++) {
+        double inverse = 1.0/(2.0 + solve->eigenvalues[k]);
+        factors[k] = -inverse;
+        values[k] *= inverse;
+    }
+    for (long r=1 ; r<inner_rows ; r++) {
+        double* row = &values[r*inner_cols];
+        double* previous_row = row - inner_cols;
+        double* factor_row = &factors[r*inner_cols];
+        double* previous_factor_row = factor_row - inner_cols;
+
+        for (long k=start ; k<end ; k++) {
+            double inverse = 1.0/(2.0 + solve->eigenvalues[k] + previous_factor_row[k]);
+            factor_row[k] = -inverse;
+            row[k] = (row[k] + previous_row[k])*inverse;
+        }
+    }
+
+    // back substitution
+    for (long r=inner_rows-2 ; r>=0 ; r--) {
+        double* row = &values[r*inner_cols];
+        double* next_row = row + inner_cols;
+        double* factor_row = &factors[r*inner_cols];
+
+        for (long k=start ; k<end ; k++) {
+            row[k] -= factor_row[k]*next_row[k];
+        }
+    }
+}
+
+// Pool task, inverse DST along each row and scaled copy into the grid
+void inverseTask(int worker, int worker_count, void* arg) {
+    DST_SOLVE* solve = (DST_SOLVE*)arg;
+    int cols = solve->cols;
+    int inner_rows = solve->rows - 2;
+    int inner_cols = cols - 2;
+    double scale = 2.0/(inner_cols + 1);
+
+    long start, end;
+    splitRange(worker, worker_count, inner_rows, &start, &end);
+
+    double complex* work = malloc(dstWorkSize(solve->plan)*sizeof(double complex));
+    for (long r=start ; r<end ; r+=2) {
+        double* row_a = &solve->buffer[r*inner_cols];
+        double* row_b = r+1 < end ? row_a + inner_cols : NULL;
+
+        dst(solve->plan, row_a, row_b, work);
+        for (int c=0 ; c<inner_cols ; c++) {
+            solve->grid[(r + 1)*cols + c + 1] = row_a[c]*scale;
+        }
+        if (row_b != NULL) {
+            for (int c=0 ; c<inner_cols ; c++) {
+                solve->grid[(r + 2)*cols + c + 1] = row_b[c]*scale;
+            }
+        }
+    }
+    free(work);
+}
+
+// Returns the eigenvalues 2 - 2cos(k pi / (n+1)) of the 1D second difference
+// operator of length n
+double* makeEigenvalues(int n) {
+    double* eigenvalues = malloc(n*sizeof(double));
+    for (int k=0 ; k<n ; k++) {
+        double s = sin((k + 1)*M_PI/(2.0*(n + 1)));
+        eigenvalues[k] = 4.0*s*s;
+    }
+    return eigenvalues;
+}
+
+// Returns 1 if the current problem can be solved directly, that is a uniform
+// Laplace problem on a rectangle with every edge cell fixed
+int dstQualifies() {
+    return matrix_size >= 3;
+}
+
+// Overwrites the interior of grid, which has rows*cols cells stored row by row,
+// with the exact solution of the discrete Laplace problem whose Dirichlet
+// boundary is the outer ring of cells. Must be called with the pool started.
+void solveDirect(double* grid, int rows, int cols) {
+    if (rows < 3 || cols < 3) {
+        return;
+    }
+
+    long inner_count = (long)(rows - 2)*(cols - 2);
+
+    DST_SOLVE solve;
+    solve.grid = grid;
+    solve.rows = rows;
+    solve.cols = cols;
+    solve.buffer = malloc(inner_count*sizeof(double));
+    solve.factors = malloc(inner_count*sizeof(double));
+    solve.plan = makeDstPlan(cols - 2);
+    solve.eigenvalues = makeEigenvalues(cols - 2);
+
+    runPool(forwardTask, &solve);
+    runPool(tridiagonalTask, &solve);
+    runPool(inverseTask, &solve);
+
+    freeDstPlan(solve.plan);
+    free(solve.eigenvalues);
+    free(solve.buffer);
+    free(solve.factors);
+}
@@ -0,0 +1,351 @@
+/**
+* Relaxation over a general sparse graph
+* Oliver Redeyoff
+*
+* Unstructured meshes don't fit in a matrix, so this relaxes a graph given as a
+* CSR adjacency instead. Each free vertex is repeatedly replaced by the average
+* of its neighbours, weighted by the edge weights when there are any, while the
+* fixed vertices play the part of the matrix's edges:
+*
+* 1 - the vertices are renumbered in reverse Cuthill-McKee order, a breadth
+*     first search from a low degree vertex visiting neighbours by increasing
+*     degree, reversed. Neighbours end up with close numbers, so a vertex's
+*     neighbours are mostly in the cache lines read for the vertices before it
+*
+* 2 - the renumbered vertices are cut into one contiguous range per worker
+*     with equal numbers of adjacency entries. The reordering keeps each range
+*     a narrow band of the graph, so few of its edges lead to other workers'
+*     vertices
+*
+* 3 - the workers of the pool relax their ranges into a second buffer, then
+*     the buffers are swapped, until no vertex changed by more than
+*     decimal_value in a sweep. The file sets every vertex's starting value
+*     and values can move either way, so the change test is on the absolute
+*     difference. Anderson acceleration, when asked for, mixes the vertex
+*     values as they are numbered here
+*
+* The file format is whitespace separated: the vertex count V, the adjacency
+* entry count E and 1 if the edges are weighted (else 0), followed by V+1 row
+* offsets, E column indexes, E weights if weighted, V fixed flags and V
+* starting values.
+*
+**/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// state shared with the pool tasks of one solve, on the renumbered graph
+typedef struct graph_solve {
+    long vertex_count;
+    long* row_offsets;
+    long* columns;
+    double* weights;        // NULL if unweighted
+    double* weight_sums;    // reciprocal of each vertex's total weight
+    char* fixed;
+    double* values;         // values read this sweep
+    double* new_values;     // values written this sweep
+    long* range_starts;     // first vertex of each worker
+    int changed;
+} GRAPH_SOLVE;
+
+// Frees a graph and everything it holds
+void freeGraph(GRAPH* graph) {
+    if (graph == NULL) {
+        return;
+    }
+    free(graph->row_offsets);
+    free(graph->columns);
+    free(graph->weights);
+    free(graph->fixed);
+    free(graph->values);
+    free(graph);
+}
+
+// Returns the graph read from a file in the format described at the top of
+// this file, or NULL if the file can't be read or isn't a valid graph
+GRAPH* loadGraph(char* file_name) {
+    FILE* file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Could not open '%s' for reading\n", file_name);
+        return NULL;
+    }
+
+    long vertex_count, entry_count;
+    int weighted;
+    if (fscanf(file, "%ld %ld %d", &vertex_count, &entry_count, &weighted) != 3
+            || vertex_count < 0 || entry_count < 0) {
+        printf("'%s' doesn't start with a graph header\n", file_name);
+        fclose(file);
+        return NULL;
+    }
+
+    GRAPH* graph = calloc(1, sizeof(GRAPH));
+    graph->vertex_count = vertex_count;
+    graph->entry_count = entry_count;
+    graph->row_offsets = malloc((vertex_count + 1)*sizeof(long));
+    graph->columns = malloc(entry_count*sizeof(long));
+    graph->weights = weighted ? malloc(entry_count*sizeof(double)) : NULL;
+    graph->fixed = malloc(vertex_count);
+    graph->values = malloc(vertex_count*sizeof(double));
+
+    int valid = 1;
+    for (long i=0 ; valid && i<=vertex_count ; i++) {
+        valid = fscanf(file, "%ld", &graph->row_offsets[i]) == 1
+                && graph->row_offsets[i] >= (i > 0 ? graph->row_offsets[i - 1] : 0);
+    }
+    valid = valid && graph->row_offsets[0] == 0 && graph->row_offsets[vertex_count] == entry_count;
+    for (long e=0 ; valid && e<entry_count ; e++) {
+        valid = fscanf(file, "%ld", &graph->columns[e]) == 1
+                && graph->columns[e] >= 0 && graph->columns[e] < vertex_count;
+    }
+    for (long e=0 ; valid && weighted && e<entry_count ; e++) {
+        valid = fscanf(file, "%lf", &graph->weights[e]) == 1 && graph->weights[e] >= 0;
+    }
+    for (long i=0 ; valid && i<vertex_count ; i++) {
+        int fixed;
+        valid = fscanf(file, "%d", &fixed) == 1;
+        graph->fixed[i] = fixed != 0;
+    }
+    for (long i=0 ; valid && i<vertex_count ; i++) {
+        valid = fscanf(file, "%lf", &graph->values[i]) == 1;
+    }
+    fclose(file);
+
+    if (!valid) {
+        printf("'%s' isn't a valid graph\n", file_name);
+        freeGraph(graph);
+        return NULL;
+    }
+    return graph;
+}
+
+// Writes the values of a graph's vertices to a file, one per line
+void writeGraph(char* file_name, GRAPH* graph) {
+    FILE* file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Could not open '%s' for writing\n", file_name);
+        return;
+    }
+
+    for (long i=0 ; i<graph->vertex_count ; i++) {
+        fprintf(file, "%f\n", graph->values[i]);
+    }
+    fclose(file);
+}
+
+// Fills order with the vertices in reverse Cuthill-McKee order, each connected
+// component starting from its lowest degree vertex
+void getRcmOrder(GRAPH* graph, long* order) {
+    long n = graph->vertex_count;
+    long* offsets = graph->row_offsets;
+    char* visited = calloc(n, 1);
+    long head = 0;
+    long tail = 0;
+
+    // vertices sorted by degree, so each component starts from its lowest
+    // degree vertex and neighbours can be visited by increasing degree
+    long* by_degree = malloc(n*sizeof(long));
+    long max_degree = 0;
+    for (long i=0 ; i<n ; i++) {
+        long degree = offsets[i + 1] - offsets[i];
+        max_degree = degree > max_degree ? degree : max_degree;
+    }
+    long* degree_starts = calloc(max_degree + 2, sizeof(long));
+    for (long i=0 ; i<n ; i++) {
+        degree_starts[offsets[i + 1] - offsets[i] + 1]++;
+    }
+    for (long d=0 ; d<=max_degree ; d++) {
+        degree_starts[d + 1] += degree_starts[d];
+    }
+    for (long i=0 ; i<n ; i++) {
+        by_degree[degree_starts[offsets[i + 1] - offsets[i]]++] = i;
+    }
+
+    long next_start = 0;
+    while (tail < n) {
+        // start a new component
+        while (visited[by_degree[next_start]]) {
+            next_start++;
+        }
+        order[tail++] = by_degree[next_start];
+        visited[by_degree[next_start]] = 1;
+
+        while (head < tail) {
+            long vertex = order[head++];
+            long first = tail;
+
+            for (long e=offsets[vertex] ; e<offsets[vertex+1] ; e++) {
+                long neighbour = graph->columns[e];
+                if (!visited[neighbour]) {
+                    visited[neighbour] = 1;
+                    order[tail++] = neighbour;
+                }
+            }
+
+            // insertion sort of the new vertices by degree, there are only
+            // as many as the vertex has neighbours
+            for (long k=first+1 ; k<tail ; k++) {
+                long moving = order[k];
+                long degree = offsets[moving + 1] - offsets[moving];
+                long j = k;
+                while (j > first && offsets[order[j - 1] + 1] - offsets[order[j - 1]] > degree) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = moving;
+            }
+        }
+    }
+
+    for (long i=0 ; i<n/2 ; i++) {
+        long swap = order[i];
+        order[i] = order[n - 1 - i];
+        order[n - 1 - i] = swap;
+    }
+
+    free(visited);
+    free(by_degree);
+    free(degree_starts);
+}
+
+// Pool task, one Jacobi sweep over the worker's range of vertices
+void graphSweepTask(int worker, int worker_count, void* arg) {
+    GRAPH_SOLVE* solve = (GRAPH_SOLVE*)arg;
+    long* offsets = solve->row_offsets;
+    long* columns = solve->columns;
+    double* values = solve->values;
+    int changed = 0;
+
+    for (long i=solve->range_starts[worker] ; i<solve->range_starts[worker + 1] ; i++) {
+        if (solve->fixed[i]) {
+            solve->new_values[i] = values[i];
+            continue;
+        }
+
+        double sum = 0.0;
+        if (solve->weights == NULL) {
+            for (long e=offsets[i] ; e<offsets[i+1] ; e++) {
+                sum += values[columns[e]];
+            }
+        } else {
+            for (long e=offsets[i] ; e<offsets[i+1] ; e++) {
+                sum += solve->weights[e]*values[columns[e]];
+            }
+        }
+
+        double new_value = sum*solve->weight_sums[i];
+        changed |= fabs(new_value - values[i]) > decimal_value;
+        solve->new_values[i] = new_value;
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// One sweep over all the vertices, the map Anderson acceleration iterates
+void graphSweep(void* arg) {
+    runPool(graphSweepTask, arg);
+}
+
+// Relaxes the free vertices of graph until no value changes by more than
+// decimal_value, following the strategy described at the top of this file.
+// The sweeps are Anderson accelerated over the last history iterates if history
+// is above 0. Must be called with the pool started.
+void relaxGraph(GRAPH* graph, int history, int worker_count) {
+    long n = graph->vertex_count;
+    long entries = graph->entry_count;
+    GRAPH_SOLVE solve;
+    solve.vertex_count = n;
+    solve.changed = 0;
+
+    // renumber, new vertex v is old vertex order[v]
+    long* order = malloc(n*sizeof(long));
+    long* new_number = malloc(n*sizeof(long));
+    getRcmOrder(graph, order);
+    for (long v=0 ; v<n ; v++) {
+        new_number[order[v]] = v;
+    }
+
+    solve.row_offsets = malloc((n + 1)*sizeof(long));
+    solve.columns = malloc(entries*sizeof(long));
+    solve.weights = graph->weights == NULL ? NULL : malloc(entries*sizeof(double));
+    solve.weight_sums = malloc(n*sizeof(double));
+    solve.fixed = malloc(n);
+    solve.values = malloc(n*sizeof(double));
+    solve.new_values = malloc(n*sizeof(double));
+
+    solve.row_offsets[0] = 0;
+    for (long v=0 ; v<n ; v++) {
+        long old = order[v];
+        long count = graph->row_offsets[old + 1] - graph->row_offsets[old];
+        long start = solve.row_offsets[v];
+        double weight_sum = 0.0;
+
+        for (long k=0 ; k<count ; k++) {
+            long e = graph->row_offsets[old] + k;
+            solve.columns[start + k] = new_number[graph->columns[e]];
+            if (solve.weights != NULL) {
+                solve.weights[start + k] = graph->weights[e];
+                weight_sum += graph->weights[e];
+            } else {
+                weight_sum += 1.0;
+            }
+        }
+
+        solve.row_offsets[v + 1] = start + count;
+        // a free vertex without neighbours (or weight) keeps its value
+        solve.fixed[v] = graph->fixed[old] || weight_sum == 0.0;
+        solve.weight_sums[v] = weight_sum == 0.0 ? 0.0 : 1.0/weight_sum;
+        solve.values[v] = graph->values[old];
+    }
+
+    // contiguous ranges with equal shares of the adjacency entries, counting
+    // each vertex as one more so vertices without edges still cost something
+    solve.range_starts = malloc((worker_count + 1)*sizeof(long));
+    long vertex = 0;
+    for (int w=0 ; w<worker_count ; w++) {
+        solve.range_starts[w] = vertex;
+        long target = (entries + n)*(w + 1)/worker_count;
+        while (vertex < n && solve.row_offsets[vertex] + vertex < target) {
+            vertex++;
+        }
+    }
+    solve.range_starts[worker_count] = n;
+
+    if (n > 0 && history > 0) {
+        FIXED_POINT_MAP map = {graphSweep, &solve, &solve.values, &solve.new_values, 1};
+        accelerateAnderson(&map, n, decimal_value, history, worker_count);
+    } else {
+        while (n > 0) {
+            graphSweep(&solve);
+            double* swap = solve.values;
+            solve.values = solve.new_values;
+            solve.new_values = swap;
+
+            if (!solve.changed) {
+                break;
+            }
+            solve.changed = 0;
+        }
+    }
+
+    for (long v=0 ; v<n ; v++) {
+        graph->values[order[v]] = solve.values[v];
+    }
+
+    free(order);
+    free(new_number);
+    free(solve.row_offsets);
+    free(solve.columns);
+    free(solve.weights);
+    free(solve.weight_sums);
+    free(solve.fixed);
+    free(solve.values);
+    free(solve.new_values);
+    free(solve.range_starts);
+}
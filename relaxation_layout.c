@@ -0,0 +1,302 @@
+/**
+* Relaxation with pluggable matrix storage layouts
+* Oliver Redeyoff
+*
+* In row major order the cells above and below a cell are a whole row apart,
+* so for large matrices every sweep streams each row through the cache three
+* times. This keeps the matrix in one of three layouts while relaxing it:
+*
+* - row major, as everywhere else
+*
+* - tiled, LAYOUT_TILE*LAYOUT_TILE tiles stored one after the other, each row
+*   major inside, so the rows above and below are in the same tile except on
+*   its edges. The matrix is padded to a whole number of tiles.
+*
+* - Morton (Z-order), the bits of the row and column interleaved, which keeps
+*   neighbours close at every scale without choosing a tile size. The matrix
+*   is padded to a power of two per side. Neighbour offsets come from tables
+*   of the dilated row and column numbers.
+*
+* Each layout has its own sweep kernel. The matrix is converted from row major
+* when the solve starts and back when it ends, which is the only place the
+* rest of the program sees it, and relaxed with the same stop rule as
+* relaxMatrix using 2 buffers shared between the workers of the pool. Anderson
+* acceleration mixes the stored vector directly, padding and all, as padding
+* cells are never written and drop out of the mixing.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// cells per side of a tile of the tiled layout
+#define LAYOUT_TILE 64
+
+// layout names accepted by -l, in LAYOUT order
+char* layout_names[LAYOUT_COUNT] = {"rowmajor", "tiled", "morton"};
+
+// a matrix stored in one of the layouts
+typedef struct layout_grid {
+    int layout;
+    long size;              // cells per side of the matrix
+    long padded;            // cells per side of the storage
+    long count;             // cells in the storage
+    long* dilated_rows;     // Morton offset of each row, bits in odd positions
+    long* dilated_cols;     // Morton offset of each column, bits in even positions
+    double* values;         // storage read this sweep
+    double* new_values;     // storage written this sweep
+    POOL_TASK sweep;        // kernel of the layout
+    int changed;
+} LAYOUT_GRID;
+
+// Returns the layout with the given name, or -1 if there is none
+int getLayout(char* name) {
+    for (int i=0 ; i<LAYOUT_COUNT ; i++) {
+        if (strcmp(name, layout_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Spreads the bits of x so that bit k moves to bit 2k
+long dilate(long x) {
+    long result = 0;
+    for (int bit=0 ; bit<32 ; bit++) {
+        result |= ((x >> bit) & 1L) << (2*bit);
+    }
+    return result;
+}
+
+// Returns where cell (i, j) is stored
+static inline long layoutIndex(LAYOUT_GRID* grid, long i, long j) {
+    switch (grid->layout) {
+    case LAYOUT_TILED: {
+        long tiles_per_side = grid->padded/LAYOUT_TILE;
+        long tile = (i/LAYOUT_TILE)*tiles_per_side + j/LAYOUT_TILE;
+        return tile*LAYOUT_TILE*LAYOUT_TILE + (i%LAYOUT_TILE)*LAYOUT_TILE + j%LAYOUT_TILE;
+    }
+    case LAYOUT_MORTON:
+        return grid->dilated_rows[i] | grid->dilated_cols[j];
+    default:
+        return i*grid->size + j;
+    }
+}
+
+// Pool task, one sweep over the worker's share of rows of a row major matrix
+void rowMajorSweepTask(int worker, int worker_count, void* arg) {
+    LAYOUT_GRID* grid = (LAYOUT_GRID*)arg;
+    long n = grid->size;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        double* up = &grid->values[(i - 1)*n];
+        double* row = &grid->values[i*n];
+        double* down = &grid->values[(i + 1)*n];
+        double* out = &grid->new_values[i*n];
+
+        for (long j=1 ; j<n-1 ; j++) {
+            double new_value = (up[j] + row[j + 1] + down[j] + row[j - 1])/4;
+            changed |= fabs(new_value - row[j]) > decimal_value;
+            out[j] = new_value;
+        }
+    }
+
+    if (changed) {
+        grid->changed = 1;
+    }
+}
+
+// Pool task, one sweep over the worker's share of tiles of a tiled matrix.
+// Inside a tile the neighbours are at fixed offsets, only the first and last
+// row and column of a tile read from the adjacent tiles.
+void tiledSweepTask(int worker, int worker_count, void* arg) {
+    LAYOUT_GRID* grid = (LAYOUT_GRID*)arg;
+    long n = grid->size;
+    long T = LAYOUT_TILE;
+    long tiles_per_side = grid->padded/T;
+    long tile_cells = T*T;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, tiles_per_side*tiles_per_side, &start, &end);
+
+    for (long tile=start ; tile<end ; tile++) {
+        long ti = tile/tiles_per_side;
+        long tj = tile%tiles_per_side;
+
+        // cells of the tile inside the matrix's interior
+        long i0 = ti*T < 1 ? 1 : ti*T;
+        long i1 = ti*T + T - 1 > n - 2 ? n - 2 : ti*T + T - 1;
+        long j0 = (tj*T < 1 ? 1 : tj*T) - tj*T;
+        long j1 = (tj*T + T - 1 > n - 2 ? n - 2 : tj*T + T - 1) - tj*T;
+        if (i0 > i1 || j0 > j1) {
+            continue;
+        }
+
+        double* base = &grid->values[tile*tile_cells];
+        double* out_base = &grid->new_values[tile*tile_cells];
+
+        for (long i=i0 ; i<=i1 ; i++) {
+            long li = i - ti*T;
+            double* row = &base[li*T];
+            double* out = &out_base[li*T];
+            double* up = li > 0 ? row - T : &base[-tiles_per_side*tile_cells + (T - 1)*T];
+            double* down = li < T - 1 ? row + T : &base[tiles_per_side*tile_cells];
+
+            long j = j0;
+            if (j == 0) {
+                double left = base[-tile_cells + li*T + T - 1];
+                double new_value = (up[0] + row[1] + down[0] + left)/4;
+                changed |= fabs(new_value - row[0]) > decimal_value;
+                out[0] = new_value;
+                j++;
+            }
+            long middle_end = j1 < T - 1 ? j1 + 1 : T - 1;
+            for ( ; j<middle_end ; j++) {
+                double new_value = (up[j] + row[j + 1] + down[j] + row[j - 1])/4;
+                changed |= fabs(new_value - row[j]) > decimal_value;
+                out[j] = new_value;
+            }
+            if (j == T - 1 && j <= j1) {
+                double right = base[tile_cells + li*T];
+                double new_value = (up[j] + right + down[j] + row[j - 1])/4;
+                changed |= fabs(new_value - row[j]) > decimal_value;
+                out[j] = new_value;
+            }
+        }
+    }
+
+    if (changed) {
+        grid->changed = 1;
+    }
+}
+
+// Pool task, one sweep over the worker's share of a Morton ordered matrix.
+// Cells are visited in storage order, so reads of the cell and writes are
+// sequential and the neighbours are found by swapping one coordinate's
+// dilated offset.
+void mortonSweepTask(int worker, int worker_count, void* arg) {
+    LAYOUT_GRID* grid = (LAYOUT_GRID*)arg;
+    long n = grid->size;
+    long* rows = grid->dilated_rows;
+    long* cols = grid->dilated_cols;
+    int changed = 0;
+
+    // interleaving is monotonic in both coordinates, so no cell of the matrix
+    // is stored after its last one and the padding past it can be skipped
+    long start, end;
+    splitRange(worker, worker_count, rows[n - 1] + cols[n - 1] + 1, &start, &end);
+
+    for (long z=start ; z<end ; z++) {
+        // the column's bits are the even ones of z and the row's the odd ones
+        long x = z & 0x5555555555555555L;
+        long y = z & 0xAAAAAAAAAAAAAAAAL;
+
+        // stepping a dilated number sets the bits in between so the carry
+        // ripples through them
+        long i_plus = ((y | 0x5555555555555555L) + 1) & 0xAAAAAAAAAAAAAAAAL;
+        long j_plus = ((x | 0xAAAAAAAAAAAAAAAAL) + 1) & 0x5555555555555555L;
+        long i_minus = (y - 1) & 0xAAAAAAAAAAAAAAAAL;
+        long j_minus = (x - 1) & 0x5555555555555555L;
+
+        // skip the edges and padding, the row and column are inside the
+        // interior exactly when both their neighbours are inside the matrix
+        if (y == 0 || x == 0 || i_plus > rows[n - 1] || j_plus > cols[n - 1]) {
+            continue;
+        }
+
+        double* values = grid->values;
+        double new_value = (values[i_minus | x] + values[y | j_plus] + values[i_plus | x] + values[y | j_minus])/4;
+        changed |= fabs(new_value - values[z]) > decimal_value;
+        grid->new_values[z] = new_value;
+    }
+
+    if (changed) {
+        grid->changed = 1;
+    }
+}
+
+// One sweep over the whole matrix, the map Anderson acceleration iterates
+void layoutSweep(void* arg) {
+    LAYOUT_GRID* grid = (LAYOUT_GRID*)arg;
+    runPool(grid->sweep, grid);
+}
+
+// Relaxes grid, a size*size row major matrix, stored in the given layout while
+// it is relaxed. The sweeps are Anderson accelerated over the last history
+// iterates if history is above 0. Must be called with the pool started.
+void relaxLayout(double* matrix_values, int size, int layout, int history, int worker_count) {
+    long n = size;
+    LAYOUT_GRID grid;
+    grid.layout = layout;
+    grid.size = n;
+    grid.changed = 0;
+    grid.dilated_rows = NULL;
+    grid.dilated_cols = NULL;
+
+    grid.sweep = rowMajorSweepTask;
+    grid.padded = n;
+    if (layout == LAYOUT_TILED) {
+        grid.sweep = tiledSweepTask;
+        grid.padded = (n + LAYOUT_TILE - 1)/LAYOUT_TILE*LAYOUT_TILE;
+    } else if (layout == LAYOUT_MORTON) {
+        grid.sweep = mortonSweepTask;
+        grid.padded = 1;
+        while (grid.padded < n) {
+            grid.padded <<= 1;
+        }
+        grid.dilated_rows = malloc(grid.padded*sizeof(long));
+        grid.dilated_cols = malloc(grid.padded*sizeof(long));
+        for (long k=0 ; k<grid.padded ; k++) {
+            grid.dilated_cols[k] = dilate(k);
+            grid.dilated_rows[k] = dilate(k) << 1;
+        }
+    }
+    grid.count = grid.padded*grid.padded;
+
+    // convert in, padding cells are never read
+    grid.values = calloc(grid.count, sizeof(double));
+    grid.new_values = malloc(grid.count*sizeof(double));
+    for (long i=0 ; i<n ; i++) {
+        for (long j=0 ; j<n ; j++) {
+            grid.values[layoutIndex(&grid, i, j)] = matrix_values[i*n + j];
+        }
+    }
+    memcpy(grid.new_values, grid.values, grid.count*sizeof(double));
+
+    if (n >= 3 && history > 0) {
+        FIXED_POINT_MAP map = {layoutSweep, &grid, &grid.values, &grid.new_values, 1};
+        accelerateAnderson(&map, grid.count, decimal_value, history, worker_count);
+    } else {
+        while (n >= 3) {
+            layoutSweep(&grid);
+            double* swap = grid.values;
+            grid.values = grid.new_values;
+            grid.new_values = swap;
+
+            if (!grid.changed) {
+                break;
+            }
+            grid.changed = 0;
+        }
+    }
+
+    // convert out
+    for (long i=0 ; i<n ; i++) {
+        for (long j=0 ; j<n ; j++) {
+            matrix_values[i*n + j] = grid.values[layoutIndex(&grid, i, j)];
+        }
+    }
+
+    free(grid.values);
+    free(grid.new_values);
+    free(grid.dilated_rows);
+    free(grid.dilated_cols);
+}
@@ -0,0 +1,295 @@
+/**
+* Zebra line relaxation
+* Oliver Redeyoff
+*
+* Point relaxation moves information one cell per sweep, which is hopeless
+* when the medium couples cells much more strongly along one axis than the
+* other. This solves whole lines of cells at once instead, every cell of a
+* line taking the value that balances its neighbours with the cells beside
+* the line held fixed:
+*
+* - the lines are the rows, the columns, or both in turn, each sweep relaxing
+*   the even lines then the odd ones (zebra order). Lines of one color only
+*   read lines of the other, so they are solved in place and in parallel
+*
+* - each line is a tridiagonal system whose matrix depends only on the
+*   medium, so its Thomas elimination is done once before the first sweep.
+*   A line then costs a forward and a back substitution
+*
+* - lines of one color are solved in batches of LINE_BATCH. The eliminated
+*   coefficients are stored interleaved, position by position with one entry
+*   per line of the batch, and the right hand sides are gathered into the same
+*   order, so the substitutions run down all the lines of a batch at once and
+*   are vectorised across them
+*
+* The medium is given as for relaxMedium and the sweeps stop once no cell
+* changed by more than decimal_value in a sweep. A line solve moves the cells
+* of the line together and values can move either way, so the change test is
+* on the absolute difference.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// lines solved together, one vector of doubles wide with AVX-512
+#define LINE_BATCH 8
+
+// direction names accepted by -z, in LINE_DIRECTION order
+char* line_direction_names[LINE_DIRECTION_COUNT] = {"rows", "columns", "alternating"};
+
+// the lines of one direction and color and their eliminated systems, each
+// array holding LINE_BATCH entries per position per batch
+typedef struct line_set {
+    long count;             // lines in the set
+    long first;             // index of the first line across the matrix
+    long batch_count;
+    long along_step;        // index step between cells of a line
+    long across_step;       // index step between lines
+    float* along;           // coefficients of the faces after each cell along and
+    float* across;          // across the line
+    double* lower;          // coupling to the previous cell of the line
+    double* upper;          // eliminated coupling to the next cell
+    double* pivots;         // reciprocals of the eliminated diagonal
+} LINE_SET;
+
+// state shared with the pool tasks of one solve
+typedef struct line_solve {
+    long size;
+    double* values;
+    LINE_SET sets[2][2];    // by direction, rows or columns, then color
+    int first_direction;    // directions relaxed each sweep
+    int last_direction;
+    LINE_SET* set;          // lines being relaxed
+    double** work;          // batch of right hand sides of each worker
+    int changed;
+} LINE_SOLVE;
+
+// Returns the line direction with the given name, or -1 if there is none
+int getLineDirection(char* name) {
+    for (int i=0 ; i<LINE_DIRECTION_COUNT ; i++) {
+        if (strcmp(name, line_direction_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the index of cell position of line m of a set, position 0 being
+// the cell after the edge
+static inline long lineCell(LINE_SET* set, long m, long position) {
+    return (set->first + 2*m)*set->across_step + (position + 1)*set->along_step;
+}
+
+// Sets up the lines of one direction and color of an n*n matrix and
+// eliminates their systems. Lanes of the last batch past the last line get a
+// system with the solution 0.
+void initLineSet(LINE_SET* set, long n, int rows, int color, float* east, float* south) {
+    long length = n - 2;
+    set->first = 1 + color;
+    set->count = (n - 2 - color + 1)/2;
+    set->batch_count = (set->count + LINE_BATCH - 1)/LINE_BATCH;
+    set->along_step = rows ? 1 : n;
+    set->across_step = rows ? n : 1;
+    set->along = rows ? east : south;
+    set->across = rows ? south : east;
+
+    long entries = set->batch_count*length*LINE_BATCH;
+    set->lower = malloc(entries*sizeof(double));
+    set->upper = malloc(entries*sizeof(double));
+    set->pivots = malloc(entries*sizeof(double));
+
+    for (long b=0 ; b<set->batch_count ; b++) {
+        for (long lane=0 ; lane<LINE_BATCH ; lane++) {
+            long m = b*LINE_BATCH + lane;
+            double previous_upper = 0.0;
+
+            for (long p=0 ; p<length ; p++) {
+                long k = (b*length + p)*LINE_BATCH + lane;
+                if (m >= set->count) {
+                    set->lower[k] = 0.0;
+                    set->upper[k] = 0.0;
+                    set->pivots[k] = 1.0;
+                    continue;
+                }
+
+                // the cell balances d*u = before*u[p-1] + after*u[p+1] + the
+                // cells beside the line, the edge cells go to the right hand
+                // side
+                long cell = lineCell(set, m, p);
+                double before = set->along[cell - set->along_step];
+                double after = set->along[cell];
+                double diagonal = before + after + set->across[cell - set->across_step] + set->across[cell];
+
+                double lower = p == 0 ? 0.0 : before;
+                double pivot = 1/(diagonal - lower*previous_upper);
+                set->lower[k] = lower;
+                set->upper[k] = p == length - 1 ? 0.0 : after*pivot;
+                set->pivots[k] = pivot;
+                previous_upper = set->upper[k];
+            }
+        }
+    }
+}
+
+// Runs the forward and back substitutions of a batch of eliminated lines of
+// length cells down all of its lines together, work holding the right hand
+// sides on entry and the solutions on return. The loops over the lanes are
+// kept as loops so gcc vectorises them rather than unrolling them into scalar
+// code first.
+static inline void substituteBatch(double* restrict work, const double* restrict lower,
+        const double* restrict upper, const double* restrict pivots, long length) {
+    for (long lane=0 ; lane<LINE_BATCH ; lane++) {
+        work[lane] *= pivots[lane];
+    }
+    for (long p=1 ; p<length ; p++) {
+#pragma GCC unroll 1
+        for (long lane=0 ; lane<LINE_BATCH ; lane++) {
+            long k = p*LINE_BATCH + lane;
+            work[k] = (work[k] + lower[k]*work[k - LINE_BATCH])*pivots[k];
+        }
+    }
+    for (long p=length-2 ; p>=0 ; p--) {
+#pragma GCC unroll 1
+        for (long lane=0 ; lane<LINE_BATCH ; lane++) {
+            long k = p*LINE_BATCH + lane;
+            work[k] += upper[k]*work[k + LINE_BATCH];
+        }
+    }
+}
+
+// Pool task, solves the worker's share of the batches of the set being
+// relaxed
+void lineSweepTask(int worker, int worker_count, void* arg) {
+    LINE_SOLVE* solve = (LINE_SOLVE*)arg;
+    LINE_SET* set = solve->set;
+    long length = solve->size - 2;
+    long along = set->along_step;
+    long across = set->across_step;
+    double* values = solve->values;
+    double* work = solve->work[worker];
+    double threshold = decimal_value;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, set->batch_count, &start, &end);
+
+    for (long b=start ; b<end ; b++) {
+        // gather the right hand sides, the cells beside each line and the
+        // edge cells at its ends
+        for (long lane=0 ; lane<LINE_BATCH ; lane++) {
+            long m = b*LINE_BATCH + lane;
+            if (m >= set->count) {
+                for (long p=0 ; p<length ; p++) {
+                    work[p*LINE_BATCH + lane] = 0.0;
+                }
+                continue;
+            }
+
+            for (long p=0 ; p<length ; p++) {
+                long cell = lineCell(set, m, p);
+                work[p*LINE_BATCH + lane] = set->across[cell - across]*values[cell - across]
+                        + set->across[cell]*values[cell + across];
+            }
+            long first = lineCell(set, m, 0);
+            long last = lineCell(set, m, length - 1);
+            work[lane] += set->along[first - along]*values[first - along];
+            work[(length - 1)*LINE_BATCH + lane] += set->along[last]*values[last + along];
+        }
+
+        long offset = b*length*LINE_BATCH;
+        substituteBatch(work, &set->lower[offset], &set->upper[offset], &set->pivots[offset], length);
+
+        // scatter the solutions back
+        for (long lane=0 ; lane<LINE_BATCH && b*LINE_BATCH + lane<set->count ; lane++) {
+            long m = b*LINE_BATCH + lane;
+            for (long p=0 ; p<length ; p++) {
+                long cell = lineCell(set, m, p);
+                double new_value = work[p*LINE_BATCH + lane];
+                changed |= fabs(new_value - values[cell]) > threshold;
+                values[cell] = new_value;
+            }
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// One sweep, both colors of the lines of each direction in turn
+void lineSweep(void* arg) {
+    LINE_SOLVE* solve = (LINE_SOLVE*)arg;
+    for (int d=solve->first_direction ; d<=solve->last_direction ; d++) {
+        for (int color=0 ; color<2 ; color++) {
+            solve->set = &solve->sets[d][color];
+            runPool(lineSweepTask, solve);
+        }
+    }
+}
+
+// Relaxes grid, a size*size matrix, through a medium with the given
+// conductivity per cell (1 everywhere if NULL), the faces between rows scaled
+// by anisotropy, by zebra line relaxation of the lines in the given direction,
+// until no value changes by more than decimal_value. The sweeps are Anderson
+// accelerated over the last history iterates if history is above 0. Must be
+// called with the pool started.
+void relaxLines(double* grid, int size, double* conductivity, double anisotropy, int direction, int history, int worker_count) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+
+    LINE_SOLVE solve;
+    solve.size = n;
+    solve.values = grid;
+    solve.changed = 0;
+
+    float* east = malloc(n*n*sizeof(float));
+    float* south = malloc(n*n*sizeof(float));
+    getFaceCoefficients(conductivity, size, anisotropy, east, south);
+
+    solve.first_direction = direction == LINES_COLUMNS ? 1 : 0;
+    solve.last_direction = direction == LINES_ROWS ? 0 : 1;
+    for (int d=solve.first_direction ; d<=solve.last_direction ; d++) {
+        for (int color=0 ; color<2 ; color++) {
+            initLineSet(&solve.sets[d][color], n, d == 0, color, east, south);
+        }
+    }
+
+    solve.work = malloc(worker_count*sizeof(double*));
+    for (int w=0 ; w<worker_count ; w++) {
+        solve.work[w] = malloc((n - 2)*LINE_BATCH*sizeof(double));
+    }
+
+    // the lines are solved in place, so the map updates the iterate in place
+    if (history > 0) {
+        FIXED_POINT_MAP map = {lineSweep, &solve, &solve.values, NULL, 1};
+        accelerateAnderson(&map, n*n, decimal_value, history, worker_count);
+    } else {
+        while (1) {
+            lineSweep(&solve);
+            if (!solve.changed) {
+                break;
+            }
+            solve.changed = 0;
+        }
+    }
+
+    for (int d=solve.first_direction ; d<=solve.last_direction ; d++) {
+        for (int color=0 ; color<2 ; color++) {
+            free(solve.sets[d][color].lower);
+            free(solve.sets[d][color].upper);
+            free(solve.sets[d][color].pivots);
+        }
+    }
+    for (int w=0 ; w<worker_count ; w++) {
+        free(solve.work[w]);
+    }
+    free(solve.work);
+    free(east);
+    free(south);
+}
@@ -0,0 +1,211 @@
+/**
+* Relaxation through a variable and anisotropic medium
+* Oliver Redeyoff
+*
+* getSuroundingAverage assumes a uniform, isotropic medium. This relaxes the
+* steady state of a medium with a conductivity per cell instead, and
+* optionally with the conductivity between rows scaled by an anisotropy ratio:
+*
+* - each cell becomes the average of its neighbours weighted by the
+*   coefficients of the faces between them. The coefficient of a face is the
+*   harmonic mean of the conductivities of the 2 cells it separates, the
+*   conductivity of the two halves in series, so a thin insulating layer
+*   blocks the flow as it should. Faces between rows are multiplied by the
+*   anisotropy ratio
+*
+* - the face coefficients are computed once and stored as floats, one array
+*   for the faces to the right of each cell and one for the faces below, so
+*   they add 8 bytes per cell to the 16 the two buffers already stream
+*
+* - rows whose horizontal faces and the faces above and below them each hold
+*   a single coefficient, every row of a layered medium, are relaxed by a
+*   kernel with the 3 weights as constants, which needs none of the
+*   coefficient arrays. Only the other rows read them
+*
+* The medium is relaxed with the stop rule of relaxMatrix, using 2 buffers
+* shared between the workers of the pool.
+*
+**/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// state shared with the pool tasks of one solve
+typedef struct medium_solve {
+    long size;
+    float* east;            // coefficient of the face right of each cell
+    float* south;           // coefficient of the face below each cell
+    char* uniform_rows;     // 1 for rows relaxed with constant weights
+    double* values;         // values read this sweep
+    double* new_values;     // values written this sweep
+    int changed;
+} MEDIUM_SOLVE;
+
+// Returns the conductivity field read from a file written by writeMatrix, or
+// NULL if the file can't be read or holds a conductivity that isn't positive
+double* loadConductivity(char* file_name) {
+    double* conductivity = loadMatrix(file_name);
+    if (conductivity == NULL) {
+        return NULL;
+    }
+
+    for (long i=0 ; i<(long)matrix_size*matrix_size ; i++) {
+        if (!(conductivity[i] > 0)) {
+            printf("'%s' holds a conductivity that isn't positive\n", file_name);
+            free(conductivity);
+            return NULL;
+        }
+    }
+    return conductivity;
+}
+
+// Returns the coefficient of the face between two cells with the given
+// conductivities
+static inline double faceCoefficient(double a, double b) {
+    return 2*a*b/(a + b);
+}
+
+// Returns 1 if count coefficients from faces are all equal
+static inline int isConstant(const float* faces, long count) {
+    for (long k=1 ; k<count ; k++) {
+        if (faces[k] != faces[0]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Fills east and south, size*size arrays, with the coefficients of the faces
+// right of and below each cell of a medium with the given conductivity per
+// cell (1 everywhere if NULL), the faces between rows scaled by anisotropy.
+// Faces on the matrix's edge get the conductivity of their cell.
+void getFaceCoefficients(double* conductivity, int size, double anisotropy, float* east, float* south) {
+    long n = size;
+    for (long i=0 ; i<n ; i++) {
+        for (long j=0 ; j<n ; j++) {
+            double here = conductivity == NULL ? 1.0 : conductivity[i*n + j];
+            double right = conductivity == NULL || j == n - 1 ? here : conductivity[i*n + j + 1];
+            double below = conductivity == NULL || i == n - 1 ? here : conductivity[(i + 1)*n + j];
+            east[i*n + j] = faceCoefficient(here, right);
+            south[i*n + j] = anisotropy*faceCoefficient(here, below);
+        }
+    }
+}
+
+// Pool task, one sweep over the worker's share of rows
+void mediumSweepTask(int worker, int worker_count, void* arg) {
+    MEDIUM_SOLVE* solve = (MEDIUM_SOLVE*)arg;
+    long n = solve->size;
+    double threshold = decimal_value;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        const double* up = &solve->values[(i - 1)*n];
+        const double* row = &solve->values[i*n];
+        const double* down = &solve->values[(i + 1)*n];
+        double* out = &solve->new_values[i*n];
+        const float* east = &solve->east[i*n];
+        const float* north = &solve->south[(i - 1)*n];
+        const float* south = &solve->south[i*n];
+
+        if (solve->uniform_rows[i]) {
+            double across = east[0];
+            double above = north[1];
+            double below = south[1];
+            double scale = 1/(2*across + above + below);
+
+            for (long j=1 ; j<n-1 ; j++) {
+                double new_value = (across*(row[j - 1] + row[j + 1]) + above*up[j] + below*down[j])*scale;
+                changed |= fabs(new_value - row[j]) > threshold;
+                out[j] = new_value;
+            }
+        } else {
+            for (long j=1 ; j<n-1 ; j++) {
+                double west_weight = east[j - 1];
+                double east_weight = east[j];
+                double north_weight = north[j];
+                double south_weight = south[j];
+                double new_value = (west_weight*row[j - 1] + east_weight*row[j + 1] + north_weight*up[j] + south_weight*down[j])
+                        /(west_weight + east_weight + north_weight + south_weight);
+                changed |= fabs(new_value - row[j]) > threshold;
+                out[j] = new_value;
+            }
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// One sweep over the whole grid, the map Anderson acceleration iterates
+void mediumSweep(void* arg) {
+    runPool(mediumSweepTask, arg);
+}
+
+// Relaxes grid, a size*size matrix, through a medium with the given
+// conductivity per cell (1 everywhere if NULL), the faces between rows scaled
+// by anisotropy, until no value changes by more than decimal_value. The sweeps
+// are Anderson accelerated over the last history iterates if history is above
+// 0. Must be called with the pool started.
+void relaxMedium(double* grid, int size, double* conductivity, double anisotropy, int history, int worker_count) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+
+    MEDIUM_SOLVE solve;
+    solve.size = n;
+    solve.changed = 0;
+    solve.east = malloc(n*n*sizeof(float));
+    solve.south = malloc(n*n*sizeof(float));
+    solve.uniform_rows = malloc(n);
+
+    getFaceCoefficients(conductivity, size, anisotropy, solve.east, solve.south);
+
+    // the faces of row i's interior cells are east[0..n-2] of the row and
+    // south[1..n-2] of the rows above and below
+    solve.uniform_rows[0] = 0;
+    solve.uniform_rows[n - 1] = 0;
+    for (long i=1 ; i<n-1 ; i++) {
+        solve.uniform_rows[i] = isConstant(&solve.east[i*n], n - 1)
+                && isConstant(&solve.south[(i - 1)*n + 1], n - 2)
+                && isConstant(&solve.south[i*n + 1], n - 2);
+    }
+
+    solve.values = malloc(n*n*sizeof(double));
+    solve.new_values = malloc(n*n*sizeof(double));
+    memcpy(solve.values, grid, n*n*sizeof(double));
+    memcpy(solve.new_values, grid, n*n*sizeof(double));
+
+    if (history > 0) {
+        FIXED_POINT_MAP map = {mediumSweep, &solve, &solve.values, &solve.new_values, 1};
+        accelerateAnderson(&map, n*n, decimal_value, history, worker_count);
+    } else {
+        while (1) {
+            runPool(mediumSweepTask, &solve);
+            double* swap = solve.values;
+            solve.values = solve.new_values;
+            solve.new_values = swap;
+
+            if (!solve.changed) {
+                break;
+            }
+            solve.changed = 0;
+        }
+    }
+
+    memcpy(grid, solve.values, n*n*sizeof(double));
+    free(solve.values);
+    free(solve.new_values);
+    free(solve.east);
+    free(solve.south);
+    free(solve.uniform_rows);
+}
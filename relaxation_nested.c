@@ -0,0 +1,177 @@
+/**
+* Nested iteration from coarser grids
+* Oliver Redeyoff
+*
+* Relaxing from an all zero interior spends most of its sweeps carrying the
+* edge values inwards, one cell per sweep. A grid with half as many cells per
+* side carries them twice as far per sweep for a quarter of the work, so the
+* matrix is first solved at coarser resolutions:
+*
+* 1 - the matrix is injected onto levels grids, each keeping every other row
+*     and column of the one before, down to 1/2^levels of its resolution
+*
+* 2 - starting from the coarsest, each level is relaxed and its solution
+*     interpolated bilinearly onto the interior of the next finer level as its
+*     starting values, the finer level's own edge cells being kept. The matrix
+*     itself is relaxed last
+*
+* - relaxation's error is about the change per sweep divided by 1 minus the
+*   sweep's convergence factor, which shrinks with the square of the grid
+*   spacing. A level 2^k times coarser than the matrix stops when no cell
+*   changes by more than 4^k times decimal_value, so each level is relaxed
+*   to the same accuracy as the matrix rather than far beyond it
+*
+* The levels are relaxed with Jacobi sweeps shared between the workers of the
+* pool, using 2 buffers. An interpolated start lies mostly above or below the
+* solution and its cells can move either way, so unlike relaxMatrix's stop
+* rule the change test is on the absolute difference. With Anderson
+* acceleration each level is accelerated on its own, to its own threshold.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// state shared with the pool tasks relaxing one level
+typedef struct nested_solve {
+    long size;
+    double threshold;       // largest change of a settled cell
+    double* values;         // values read this sweep
+    double* new_values;     // values written this sweep
+    int changed;
+} NESTED_SOLVE;
+
+// Returns 1 if a size*size matrix can be coarsened levels times, leaving a
+// grid with an interior
+int nestedQualifies(int size, int levels) {
+    return levels >= 0 && levels < 30 && (size - 1)%(1L << levels) == 0 && (size - 1) >> levels >= 2;
+}
+
+// Fills coarse, a coarse_size*coarse_size grid, with every other row and
+// column of fine
+void injectLevel(double* fine, double* coarse, long coarse_size) {
+    long fine_size = 2*coarse_size - 1;
+    for (long i=0 ; i<coarse_size ; i++) {
+        for (long j=0 ; j<coarse_size ; j++) {
+            coarse[i*coarse_size + j] = fine[2*i*fine_size + 2*j];
+        }
+    }
+}
+
+// Overwrites the interior of fine with the bilinear interpolation of coarse, a
+// coarse_size*coarse_size grid
+void interpolateLevel(double* coarse, double* fine, long coarse_size) {
+    long m = coarse_size;
+    long n = 2*m - 1;
+    for (long i=1 ; i<n-1 ; i++) {
+        const double* top = &coarse[(i/2)*m];
+        const double* bottom = i%2 ? top + m : top;
+        double* row = &fine[i*n];
+        for (long j=1 ; j<n-1 ; j++) {
+            long left = j/2;
+            long right = j%2 ? left + 1 : left;
+            row[j] = (top[left] + top[right] + bottom[left] + bottom[right])/4;
+        }
+    }
+}
+
+// Pool task, one Jacobi sweep over the worker's share of rows
+void nestedSweepTask(int worker, int worker_count, void* arg) {
+    NESTED_SOLVE* solve = (NESTED_SOLVE*)arg;
+    long n = solve->size;
+    double threshold = solve->threshold;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        const double* up = &solve->values[(i - 1)*n];
+        const double* row = &solve->values[i*n];
+        const double* down = &solve->values[(i + 1)*n];
+        double* out = &solve->new_values[i*n];
+
+        for (long j=1 ; j<n-1 ; j++) {
+            double new_value = (up[j] + row[j + 1] + down[j] + row[j - 1])/4;
+            changed |= fabs(new_value - row[j]) > threshold;
+            out[j] = new_value;
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// One sweep over the whole level, the map Anderson acceleration iterates
+void nestedSweep(void* arg) {
+    runPool(nestedSweepTask, arg);
+}
+
+// Relaxes grid, a size*size matrix, until no value changes by more than
+// threshold in a sweep, Anderson accelerated over the last history iterates if
+// history is above 0
+void relaxLevel(double* grid, long size, double threshold, int history, int worker_count) {
+    long n = size;
+    NESTED_SOLVE solve;
+    solve.size = n;
+    solve.threshold = threshold;
+    solve.changed = 0;
+    solve.values = grid;
+    solve.new_values = malloc(n*n*sizeof(double));
+    memcpy(solve.new_values, grid, n*n*sizeof(double));
+
+    if (history > 0) {
+        FIXED_POINT_MAP map = {nestedSweep, &solve, &solve.values, &solve.new_values, 1};
+        accelerateAnderson(&map, n*n, threshold, history, worker_count);
+    } else {
+        while (1) {
+            nestedSweep(&solve);
+            double* swap = solve.values;
+            solve.values = solve.new_values;
+            solve.new_values = swap;
+
+            if (!solve.changed) {
+                break;
+            }
+            solve.changed = 0;
+        }
+    }
+
+    if (solve.values != grid) {
+        memcpy(grid, solve.values, n*n*sizeof(double));
+        solve.new_values = solve.values;
+    }
+    free(solve.new_values);
+}
+
+// Relaxes grid, a size*size matrix, after relaxing levels coarser copies of it
+// in turn, each one's solution starting the next. The levels' sweeps are
+// Anderson accelerated over the last history iterates if history is above 0.
+// Must be called with the pool started.
+void relaxNested(double* grid, int size, int levels, int history, int worker_count) {
+    double* grids[levels + 1];
+    long sizes[levels + 1];
+    grids[0] = grid;
+    sizes[0] = size;
+    for (int k=1 ; k<=levels ; k++) {
+        sizes[k] = (sizes[k - 1] - 1)/2 + 1;
+        grids[k] = malloc(sizes[k]*sizes[k]*sizeof(double));
+        injectLevel(grids[k - 1], grids[k], sizes[k]);
+    }
+
+    for (int k=levels ; k>=0 ; k--) {
+        relaxLevel(grids[k], sizes[k], decimal_value*(1L << 2*k), history, worker_count);
+
+        if (k > 0) {
+            interpolateLevel(grids[k], grids[k - 1], sizes[k]);
+        }
+    }
+
+    for (int k=1 ; k<=levels ; k++) {
+        free(grids[k]);
+    }
+}
@@ -0,0 +1,96 @@
+/**
+* Worker pool
+* Oliver Redeyoff
+*
+* Keeps thread_count-1 worker threads alive between parallel phases so that the
+* solver modes which are not plain relaxation sweeps don't pay for creating
+* threads every phase. The calling thread takes part as worker 0.
+*
+* Like the main relaxation loop the workers synchronise on 2 barriers:
+*
+* 1 - the caller publishes a task and waits at the start barrier, once every
+*     worker is waiting there they are all released
+*
+* 2 - every worker runs the task with its own index, then waits at the end
+*     barrier, once the caller has also finished its share runPool returns
+*
+**/
+
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "relaxation_technique.h"
+
+int pool_size;
+pthread_t* pool_threads;
+int* pool_indexes;
+
+POOL_TASK pool_task;
+void* pool_arg;
+
+pthread_barrier_t pool_start_barrier;
+pthread_barrier_t pool_end_barrier;
+
+// Entry point for pool worker thread, a NULL task tells it to exit
+void* initPoolThread(void* vargp) {
+    int worker = *(int*)vargp;
+
+    while (1) {
+        pthread_barrier_wait(&pool_start_barrier);
+        if (pool_task == NULL) {
+            return NULL;
+        }
+        pool_task(worker, pool_size, pool_arg);
+        pthread_barrier_wait(&pool_end_barrier);
+    }
+}
+
+// Creates the worker threads, worker_count includes the calling thread
+void startPool(int worker_count) {
+    pool_size = worker_count < 1 ? 1 : worker_count;
+    pool_threads = malloc(pool_size*sizeof(pthread_t));
+    pool_indexes = malloc(pool_size*sizeof(int));
+
+    pthread_barrier_init(&pool_start_barrier, NULL, pool_size);
+    pthread_barrier_init(&pool_end_barrier, NULL, pool_size);
+
+    for (int i=1 ; i<pool_size ; i++) {
+        pool_indexes[i] = i;
+        pthread_create(&pool_threads[i], NULL, initPoolThread, (void*)&pool_indexes[i]);
+    }
+}
+
+// Runs task on every worker and returns once they have all finished
+void runPool(POOL_TASK task, void* arg) {
+    pool_task = task;
+    pool_arg = arg;
+
+    pthread_barrier_wait(&pool_start_barrier);
+    task(0, pool_size, arg);
+    pthread_barrier_wait(&pool_end_barrier);
+}
+
+// Releases the worker threads and waits for them to exit
+void stopPool() {
+    pool_task = NULL;
+    pthread_barrier_wait(&pool_start_barrier);
+
+    for (int i=1 ; i<pool_size ; i++) {
+        pthread_join(pool_threads[i], NULL);
+    }
+
+    pthread_barrier_destroy(&pool_start_barrier);
+    pthread_barrier_destroy(&pool_end_barrier);
+    free(pool_threads);
+    free(pool_indexes);
+}
+
+// Splits count items into worker_count contiguous ranges which differ in size
+// by at most one, and sets start and end (exclusive) to the range of worker
+void splitRange(int worker, int worker_count, long count, long* start, long* end) {
+    long size = count/worker_count;
+    long remainder = count%worker_count;
+
+    *start = worker*size + (worker < remainder ? worker : remainder);
+    *end = *start + size + (worker < remainder ? 1 : 0);
+}
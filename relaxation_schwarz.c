@@ -0,0 +1,291 @@
+/**
+* Overlapping additive Schwarz domain decomposition
+* Oliver Redeyoff
+*
+* relaxMatrix synchronises every thread after every sweep, and a sweep only
+* moves information by one cell. Here the workers meet only between outer
+* iterations, and each one does as much useful work as it can in between:
+*
+* 1 - each worker owns a strip of rows, as the blocks of makeBlocks are, and
+*     copies it plus overlap rows on either side (its subdomain) from the
+*     matrix into a private buffer it allocated itself. The rows just outside
+*     the subdomain are its fixed edges
+*
+* 2 - each worker solves its subdomain with red-black SOR, using the optimal
+*     over-relaxation factor for its shape, until no cell changes by more
+*     than decimal_value. Nothing is shared while it does
+*
+* 3 - after the workers meet, each one writes only the rows it owns back to
+*     the matrix (the restricted variant, which doesn't add up the overlaps
+*     twice and needs no damping)
+*
+* 4 - optionally, a coarse grid correction: the residual of the matrix is
+*     restricted onto a grid coarse_spacing times coarser,
+*     the error equation is solved there with SOR, and its solution is
+*     interpolated bilinearly and added back. The strips alone only pass
+*     information to their neighbours each outer iteration, the coarse grid
+*     carries it across the whole matrix at once
+*
+* The outer iterations stop when one changes no cell by more than
+* decimal_value. The local solves and corrections can move cells either way,
+* so the change tests are on the absolute difference.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// a worker's subdomain, aligned so that workers don't share cache lines
+typedef struct subdomain {
+    long owned_start;       // first global row of the worker's strip
+    long owned_end;         // row after its last one
+    long first_row;         // global row of local row 0, a fixed edge row
+    long rows;              // local rows, subdomain plus both edge rows
+    double omega;           // over-relaxation factor of the local solve
+    double* values;
+} __attribute__((aligned(64))) SUBDOMAIN;
+
+// state shared with the pool tasks of one solve
+typedef struct schwarz_solve {
+    double* grid;
+    long size;
+    SUBDOMAIN* subdomains;
+    long coarse_spacing;    // matrix cells per coarse cell, 0 for none
+    long coarse_size;       // points per side of the coarse grid
+    double* coarse_rhs;     // restricted residual, scaled to the coarse grid
+    double* coarse_error;   // solution of the coarse error equation
+    int changed;
+} SCHWARZ_SOLVE;
+
+// Returns the optimal SOR factor for a rows*cols rectangle of unknowns
+double getSorFactor(long rows, long cols) {
+    double jacobi_radius = (cos(M_PI/(rows + 1)) + cos(M_PI/(cols + 1)))/2;
+    return 2/(1 + sqrt(1 - jacobi_radius*jacobi_radius));
+}
+
+// Pool task, copies the worker's subdomain from the matrix and solves it
+void schwarzSolveTask(int worker, int worker_count, void* arg) {
+    SCHWARZ_SOLVE* solve = (SCHWARZ_SOLVE*)arg;
+    SUBDOMAIN* subdomain = &solve->subdomains[worker];
+    long n = solve->size;
+    long rows = subdomain->rows;
+    double omega = subdomain->omega;
+    double threshold = decimal_value;
+    if (subdomain->owned_start == subdomain->owned_end) {
+        return;
+    }
+
+    // first touch by the worker that uses it
+    if (subdomain->values == NULL) {
+        subdomain->values = malloc(rows*n*sizeof(double));
+    }
+    double* values = subdomain->values;
+    memcpy(values, &solve->grid[subdomain->first_row*n], rows*n*sizeof(double));
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int color=0 ; color<2 ; color++) {
+            for (long i=1 ; i<rows-1 ; i++) {
+                double* up = &values[(i - 1)*n];
+                double* row = &values[i*n];
+                double* down = &values[(i + 1)*n];
+
+                for (long j=1 + (subdomain->first_row + i + 1 + color)%2 ; j<n-1 ; j+=2) {
+                    double step = omega*((up[j] + row[j + 1] + down[j] + row[j - 1])/4 - row[j]);
+                    changed |= fabs(step) > threshold;
+                    row[j] += step;
+                }
+            }
+        }
+    }
+}
+
+// Pool task, writes the rows the worker owns back to the matrix
+void schwarzWriteTask(int worker, int worker_count, void* arg) {
+    SCHWARZ_SOLVE* solve = (SCHWARZ_SOLVE*)arg;
+    SUBDOMAIN* subdomain = &solve->subdomains[worker];
+    long n = solve->size;
+    double threshold = decimal_value;
+    int changed = 0;
+
+    for (long i=subdomain->owned_start ; i<subdomain->owned_end ; i++) {
+        double* row = &solve->grid[i*n];
+        double* local = &subdomain->values[(i - subdomain->first_row)*n];
+        for (long j=1 ; j<n-1 ; j++) {
+            changed |= fabs(local[j] - row[j]) > threshold;
+            row[j] = local[j];
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Returns the residual, sum of the neighbours minus 4 times the cell, of an
+// interior cell of an n*n matrix
+static inline double residualAt(double* grid, long n, long i, long j) {
+    long k = i*n + j;
+    return grid[k - n] + grid[k + 1] + grid[k + n] + grid[k - 1] - 4*grid[k];
+}
+
+// Pool task, restricts the residual onto the worker's share of coarse rows
+// with the transpose of the bilinear interpolation, each coarse point
+// gathering the residuals within coarse_spacing of it weighted by how much
+// it contributes to them. The coarse equation 4e - (sum of neighbours) = rhs
+// then has the sum as its right hand side.
+void coarseRestrictTask(int worker, int worker_count, void* arg) {
+    SCHWARZ_SOLVE* solve = (SCHWARZ_SOLVE*)arg;
+    long n = solve->size;
+    long m = solve->coarse_size;
+    long c = solve->coarse_spacing;
+
+    long start, end;
+    splitRange(worker, worker_count, m - 2, &start, &end);
+
+    for (long ci=start+1 ; ci<end+1 ; ci++) {
+        for (long cj=1 ; cj<m-1 ; cj++) {
+            double sum = 0.0;
+            for (long di=1-c ; di<c ; di++) {
+                double row_weight = (double)(c - labs(di))/c;
+                for (long dj=1-c ; dj<c ; dj++) {
+                    double weight = row_weight*(c - labs(dj))/c;
+                    sum += weight*residualAt(solve->grid, n, ci*c + di, cj*c + dj);
+                }
+            }
+            solve->coarse_rhs[ci*m + cj] = sum;
+        }
+    }
+}
+
+// Pool task, adds the interpolated coarse error to the worker's share of rows
+void coarseCorrectTask(int worker, int worker_count, void* arg) {
+    SCHWARZ_SOLVE* solve = (SCHWARZ_SOLVE*)arg;
+    long n = solve->size;
+    long m = solve->coarse_size;
+    long c = solve->coarse_spacing;
+    double* error = solve->coarse_error;
+    double threshold = decimal_value;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        long ci = i/c;
+        double fi = (double)(i - ci*c)/c;
+        for (long j=1 ; j<n-1 ; j++) {
+            long cj = j/c;
+            double fj = (double)(j - cj*c)/c;
+            double* top = &error[ci*m + cj];
+            double* bottom = fi > 0 ? top + m : top;
+            double right_top = fj > 0 ? top[1] : top[0];
+            double right_bottom = fj > 0 ? bottom[1] : bottom[0];
+            double correction = (1 - fi)*((1 - fj)*top[0] + fj*right_top)
+                    + fi*((1 - fj)*bottom[0] + fj*right_bottom);
+            changed |= fabs(correction) > threshold;
+            solve->grid[i*n + j] += correction;
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Solves the coarse error equation with red-black SOR on the calling thread,
+// the coarse grid being small, starting from no error
+void solveCoarseError(SCHWARZ_SOLVE* solve) {
+    long m = solve->coarse_size;
+    double* error = solve->coarse_error;
+    double* rhs = solve->coarse_rhs;
+    double omega = getSorFactor(m - 2, m - 2);
+    double threshold = decimal_value;
+    memset(error, 0, m*m*sizeof(double));
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int color=0 ; color<2 ; color++) {
+            for (long i=1 ; i<m-1 ; i++) {
+                for (long j=1 + (i + 1 + color)%2 ; j<m-1 ; j+=2) {
+                    long k = i*m + j;
+                    double step = omega*((error[k - m] + error[k + 1] + error[k + m] + error[k - 1] + rhs[k])/4 - error[k]);
+                    changed |= fabs(step) > threshold;
+                    error[k] += step;
+                }
+            }
+        }
+    }
+}
+
+// Relaxes grid, a size*size matrix, by restricted additive Schwarz iterations
+// on one strip per worker, each extended by overlap rows, with a coarse grid
+// correction every iteration if coarse_spacing is above 1 and divides size-1.
+// Must be called with the pool started.
+void relaxSchwarz(double* grid, int size, int overlap, int coarse_spacing, int worker_count) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+
+    SCHWARZ_SOLVE solve;
+    solve.grid = grid;
+    solve.size = n;
+    solve.changed = 0;
+    solve.subdomains = aligned_alloc(64, worker_count*sizeof(SUBDOMAIN));
+
+    for (int w=0 ; w<worker_count ; w++) {
+        SUBDOMAIN* subdomain = &solve.subdomains[w];
+        long start, end;
+        splitRange(w, worker_count, n - 2, &start, &end);
+        subdomain->owned_start = start + 1;
+        subdomain->owned_end = end + 1;
+
+        long first = subdomain->owned_start - overlap;
+        long last = subdomain->owned_end - 1 + overlap;
+        subdomain->first_row = first < 1 ? 0 : first - 1;
+        subdomain->rows = (last > n - 2 ? n - 1 : last + 1) - subdomain->first_row + 1;
+        subdomain->omega = getSorFactor(subdomain->rows - 2, n - 2);
+        subdomain->values = NULL;
+    }
+
+    solve.coarse_spacing = coarse_spacing > 1 && (n - 1)%coarse_spacing == 0 ? coarse_spacing : 0;
+    solve.coarse_size = solve.coarse_spacing > 0 ? (n - 1)/coarse_spacing + 1 : 0;
+    if (solve.coarse_size < 3) {
+        solve.coarse_spacing = 0;
+    }
+    solve.coarse_rhs = NULL;
+    solve.coarse_error = NULL;
+    if (solve.coarse_spacing > 0) {
+        solve.coarse_rhs = calloc(solve.coarse_size*solve.coarse_size, sizeof(double));
+        solve.coarse_error = malloc(solve.coarse_size*solve.coarse_size*sizeof(double));
+    }
+
+    while (1) {
+        runPool(schwarzSolveTask, &solve);
+        runPool(schwarzWriteTask, &solve);
+
+        if (solve.coarse_spacing > 0) {
+            runPool(coarseRestrictTask, &solve);
+            solveCoarseError(&solve);
+            runPool(coarseCorrectTask, &solve);
+        }
+
+        if (!solve.changed) {
+            break;
+        }
+        solve.changed = 0;
+    }
+
+    for (int w=0 ; w<worker_count ; w++) {
+        free(solve.subdomains[w].values);
+    }
+    free(solve.subdomains);
+    free(solve.coarse_rhs);
+    free(solve.coarse_error);
+}
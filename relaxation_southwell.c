@@ -0,0 +1,313 @@
+/**
+* Residual priority (Southwell) relaxation
+* Oliver Redeyoff
+*
+* relaxMatrix sweeps every cell until the whole matrix has settled, even when
+* only a small part of it is still moving, as after a change to part of the
+* edge of an already solved matrix. This relaxes only where the residual is,
+* the largest first:
+*
+* 1 - the interior is split into tiles of SOUTHWELL_TILE*SOUTHWELL_TILE cells.
+*     The residual of a tile is the most any of its cells would change if set
+*     to the average of its neighbours, and a tile whose residual is above
+*     decimal_value is kept in the bucket of its residual's power of 2 above
+*     decimal_value. Buckets are linked lists, so a tile moves between them in
+*     constant time, and the largest residual is found by looking down the
+*     few buckets from the top
+*
+* 2 - each round takes every tile in the top SOUTHWELL_BATCH_LEVELS non empty
+*     buckets, residuals within a small factor of the largest one, and gives
+*     each a few red-black Gauss-Seidel sweeps in place. Tiles are split into
+*     4 colors by the parity of their tile row and column, tiles of one color
+*     never touch, so the workers relax the batch one color at a time
+*
+* 3 - a tile's relaxation changes the residuals of its own cells and of the
+*     cells along the edges of its neighbours, so only those tiles have their
+*     residuals measured again and their buckets updated
+*
+* The residual of every tile is measured once at the start, after which the
+* work follows the residual, so a small change to an edge costs about the
+* cells it affects. Relaxation stops when no bucket holds a tile, that is when
+* no cell would change by more than decimal_value in a sweep. Changes to the
+* edge can move cells either way, so residuals are absolute values.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// side of a tile in cells
+#define SOUTHWELL_TILE 32
+
+// red-black Gauss-Seidel sweeps a tile gets each time it is relaxed, fewer if
+// it settles
+#define SOUTHWELL_SWEEPS 8
+
+// buckets of residual, bucket b holding residuals between 2^b and 2^(b+1)
+// times decimal_value, the top one holding everything larger
+#define SOUTHWELL_BUCKETS 64
+
+// buckets taken from the top each round
+#define SOUTHWELL_BATCH_LEVELS 2
+
+// state shared with the pool tasks of one solve
+typedef struct southwell_solve {
+    double* grid;
+    long size;
+    long tiles_per_side;
+    long tile_count;
+    double* residuals;      // residual of each tile
+    int* buckets;           // bucket of each tile, -1 if settled
+    long* next;             // tiles before and after each tile in its bucket,
+    long* previous;         // -1 at the ends
+    long heads[SOUTHWELL_BUCKETS];
+    long* batches[4];       // tiles of the round, by color
+    long batch_counts[4];
+    long* dirty;            // tiles whose residual must be measured again
+    long dirty_count;
+    char* is_dirty;
+    long* tasks;            // tiles the running task works through
+    long task_count;
+} SOUTHWELL_SOLVE;
+
+// Sets the first and last+1 interior row and column of a tile
+static inline void getTileBounds(SOUTHWELL_SOLVE* solve, long tile, long* row_start, long* row_end,
+        long* col_start, long* col_end) {
+    long n = solve->size;
+    long tile_row = tile/solve->tiles_per_side;
+    long tile_col = tile%solve->tiles_per_side;
+    *row_start = 1 + tile_row*SOUTHWELL_TILE;
+    *row_end = *row_start + SOUTHWELL_TILE < n - 1 ? *row_start + SOUTHWELL_TILE : n - 1;
+    *col_start = 1 + tile_col*SOUTHWELL_TILE;
+    *col_end = *col_start + SOUTHWELL_TILE < n - 1 ? *col_start + SOUTHWELL_TILE : n - 1;
+}
+
+// Returns the residual of a tile, the largest change relaxing one of its cells
+// would make
+double getTileResidual(SOUTHWELL_SOLVE* solve, long tile) {
+    long n = solve->size;
+    long row_start, row_end, col_start, col_end;
+    getTileBounds(solve, tile, &row_start, &row_end, &col_start, &col_end);
+
+    double residual = 0.0;
+    for (long i=row_start ; i<row_end ; i++) {
+        const double* up = &solve->grid[(i - 1)*n];
+        const double* row = &solve->grid[i*n];
+        const double* down = &solve->grid[(i + 1)*n];
+        for (long j=col_start ; j<col_end ; j++) {
+            double change = fabs((up[j] + row[j + 1] + down[j] + row[j - 1])/4 - row[j]);
+            residual = change > residual ? change : residual;
+        }
+    }
+    return residual;
+}
+
+// Pool task, measures the residuals of the worker's share of dirty tiles
+void southwellResidualTask(int worker, int worker_count, void* arg) {
+    SOUTHWELL_SOLVE* solve = (SOUTHWELL_SOLVE*)arg;
+
+    long start, end;
+    splitRange(worker, worker_count, solve->dirty_count, &start, &end);
+
+    for (long k=start ; k<end ; k++) {
+        long tile = solve->dirty[k];
+        solve->residuals[tile] = getTileResidual(solve, tile);
+    }
+}
+
+// Pool task, relaxes the worker's share of the tiles of one color in place
+void southwellRelaxTask(int worker, int worker_count, void* arg) {
+    SOUTHWELL_SOLVE* solve = (SOUTHWELL_SOLVE*)arg;
+    long n = solve->size;
+    double* grid = solve->grid;
+    double threshold = decimal_value;
+
+    long start, end;
+    splitRange(worker, worker_count, solve->task_count, &start, &end);
+
+    for (long k=start ; k<end ; k++) {
+        long row_start, row_end, col_start, col_end;
+        getTileBounds(solve, solve->tasks[k], &row_start, &row_end, &col_start, &col_end);
+
+        for (int sweep=0 ; sweep<SOUTHWELL_SWEEPS ; sweep++) {
+            int changed = 0;
+            for (int color=0 ; color<2 ; color++) {
+                for (long i=row_start ; i<row_end ; i++) {
+                    double* up = &grid[(i - 1)*n];
+                    double* row = &grid[i*n];
+                    double* down = &grid[(i + 1)*n];
+                    for (long j=col_start + (i + col_start + color)%2 ; j<col_end ; j+=2) {
+                        double new_value = (up[j] + row[j + 1] + down[j] + row[j - 1])/4;
+                        changed |= fabs(new_value - row[j]) > threshold;
+                        row[j] = new_value;
+                    }
+                }
+            }
+            if (!changed) {
+                break;
+            }
+        }
+    }
+}
+
+// Moves a tile to the bucket of its residual, or out of the buckets if it has
+// settled
+void updateBucket(SOUTHWELL_SOLVE* solve, long tile) {
+    int bucket = -1;
+    double ratio = solve->residuals[tile]/decimal_value;
+    if (ratio > 1) {
+        int exponent;
+        frexp(ratio, &exponent);
+        bucket = exponent - 1 < SOUTHWELL_BUCKETS - 1 ? exponent - 1 : SOUTHWELL_BUCKETS - 1;
+    }
+    if (bucket == solve->buckets[tile]) {
+        return;
+    }
+
+    // unlink from the old bucket
+    if (solve->buckets[tile] >= 0) {
+        if (solve->previous[tile] >= 0) {
+            solve->next[solve->previous[tile]] = solve->next[tile];
+        } else {
+            solve->heads[solve->buckets[tile]] = solve->next[tile];
+        }
+        if (solve->next[tile] >= 0) {
+            solve->previous[solve->next[tile]] = solve->previous[tile];
+        }
+    }
+
+    // link at the head of the new one
+    solve->buckets[tile] = bucket;
+    if (bucket >= 0) {
+        solve->previous[tile] = -1;
+        solve->next[tile] = solve->heads[bucket];
+        if (solve->heads[bucket] >= 0) {
+            solve->previous[solve->heads[bucket]] = tile;
+        }
+        solve->heads[bucket] = tile;
+    }
+}
+
+// Adds a tile to the dirty list unless it is already on it
+static inline void markDirty(SOUTHWELL_SOLVE* solve, long tile) {
+    if (!solve->is_dirty[tile]) {
+        solve->is_dirty[tile] = 1;
+        solve->dirty[solve->dirty_count++] = tile;
+    }
+}
+
+// Measures the residuals of the dirty tiles in parallel and updates their
+// buckets, emptying the dirty list
+void refreshDirtyTiles(SOUTHWELL_SOLVE* solve) {
+    runPool(southwellResidualTask, solve);
+    for (long k=0 ; k<solve->dirty_count ; k++) {
+        solve->is_dirty[solve->dirty[k]] = 0;
+        updateBucket(solve, solve->dirty[k]);
+    }
+    solve->dirty_count = 0;
+}
+
+// Relaxes grid, a size*size matrix, tile by tile in order of residual until no
+// cell would change by more than decimal_value. Must be called with the pool
+// started.
+void relaxSouthwell(double* grid, int size) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+
+    SOUTHWELL_SOLVE solve;
+    solve.grid = grid;
+    solve.size = n;
+    solve.tiles_per_side = (n - 2 + SOUTHWELL_TILE - 1)/SOUTHWELL_TILE;
+    solve.tile_count = solve.tiles_per_side*solve.tiles_per_side;
+    long tile_count = solve.tile_count;
+    long tiles_per_side = solve.tiles_per_side;
+
+    solve.residuals = malloc(tile_count*sizeof(double));
+    solve.buckets = malloc(tile_count*sizeof(int));
+    solve.next = malloc(tile_count*sizeof(long));
+    solve.previous = malloc(tile_count*sizeof(long));
+    solve.dirty = malloc(tile_count*sizeof(long));
+    solve.is_dirty = calloc(tile_count, 1);
+    solve.dirty_count = 0;
+    for (int color=0 ; color<4 ; color++) {
+        solve.batches[color] = malloc(tile_count*sizeof(long));
+    }
+    for (int b=0 ; b<SOUTHWELL_BUCKETS ; b++) {
+        solve.heads[b] = -1;
+    }
+
+    // every tile is measured once to start with
+    for (long tile=0 ; tile<tile_count ; tile++) {
+        solve.buckets[tile] = -1;
+        markDirty(&solve, tile);
+    }
+    refreshDirtyTiles(&solve);
+
+    while (1) {
+        int top = SOUTHWELL_BUCKETS - 1;
+        while (top >= 0 && solve.heads[top] < 0) {
+            top--;
+        }
+        if (top < 0) {
+            break;
+        }
+
+        // the round's batch, split by color
+        for (int color=0 ; color<4 ; color++) {
+            solve.batch_counts[color] = 0;
+        }
+        int bottom = top - SOUTHWELL_BATCH_LEVELS + 1 > 0 ? top - SOUTHWELL_BATCH_LEVELS + 1 : 0;
+        for (int b=top ; b>=bottom ; b--) {
+            for (long tile=solve.heads[b] ; tile>=0 ; tile=solve.next[tile]) {
+                int color = (tile/tiles_per_side)%2*2 + tile%tiles_per_side%2;
+                solve.batches[color][solve.batch_counts[color]++] = tile;
+            }
+        }
+
+        for (int color=0 ; color<4 ; color++) {
+            solve.tasks = solve.batches[color];
+            solve.task_count = solve.batch_counts[color];
+            if (solve.task_count > 0) {
+                runPool(southwellRelaxTask, &solve);
+            }
+        }
+
+        // the relaxed tiles and their neighbours have new residuals
+        for (int color=0 ; color<4 ; color++) {
+            for (long k=0 ; k<solve.batch_counts[color] ; k++) {
+                long tile = solve.batches[color][k];
+                long tile_row = tile/tiles_per_side;
+                long tile_col = tile%tiles_per_side;
+                markDirty(&solve, tile);
+                if (tile_row > 0) {
+                    markDirty(&solve, tile - tiles_per_side);
+                }
+                if (tile_row < tiles_per_side - 1) {
+                    markDirty(&solve, tile + tiles_per_side);
+                }
+                if (tile_col > 0) {
+                    markDirty(&solve, tile - 1);
+                }
+                if (tile_col < tiles_per_side - 1) {
+                    markDirty(&solve, tile + 1);
+                }
+            }
+        }
+        refreshDirtyTiles(&solve);
+    }
+
+    for (int color=0 ; color<4 ; color++) {
+        free(solve.batches[color]);
+    }
+    free(solve.residuals);
+    free(solve.buckets);
+    free(solve.next);
+    free(solve.previous);
+    free(solve.dirty);
+    free(solve.is_dirty);
+}
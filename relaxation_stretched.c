@@ -0,0 +1,229 @@
+/**
+* Relaxation on a stretched grid
+* Oliver Redeyoff
+*
+* getSuroundingAverage assumes the cells are evenly spaced. This relaxes a
+* grid whose columns and rows sit at given coordinates instead, so cells can
+* be packed near the edges where the solution changes quickly and spread out
+* in the bulk where it doesn't:
+*
+* - the coordinates of each axis run from 0 to 1 and are evenly spaced,
+*   clustered towards both ends by a tanh map, spaced in a geometric
+*   progression from both ends towards the middle, or read from a file
+*
+* - with spacings hw and he to the cells either side, the second difference
+*   along a row is 2/(hw+he) ((u[j+1]-u[j])/he - (u[j]-u[j-1])/hw), and
+*   likewise down a column. Each cell becomes the average of its neighbours
+*   weighted by 2/(hw(hw+he)) to the west and 2/(he(hw+he)) to the east, and
+*   the same for the rows above and below. The column weights only depend on
+*   the column and the row weights on the row, so they are computed once into
+*   a vector per axis, and a row is relaxed with its 2 row weights as
+*   constants and the column weights read contiguously alongside the values
+*
+* The grid is relaxed with 2 buffers shared between the workers of the pool
+* until no value changes by more than decimal_value in a sweep. Values can move
+* either way, so the change test is on the absolute difference.
+*
+**/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// stretching names accepted by -u, in STRETCHING order
+char* stretching_names[STRETCHING_COUNT] = {"uniform", "tanh", "geometric"};
+
+// state shared with the pool tasks of one solve
+typedef struct stretched_solve {
+    long size;
+    double* west;           // weight of the cell to the west, per column
+    double* east;           // weight of the cell to the east, per column
+    double* north;          // weight of the cell above, per row
+    double* south;          // weight of the cell below, per row
+    double* values;         // values read this sweep
+    double* new_values;     // values written this sweep
+    int changed;
+} STRETCHED_SOLVE;
+
+// Returns the stretching with the given name, or -1 if there is none
+int getStretching(char* name) {
+    for (int i=0 ; i<STRETCHING_COUNT ; i++) {
+        if (strcmp(name, stretching_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns size coordinates from 0 to 1 for the given stretching, strength being
+// the tanh factor or the ratio between neighbouring geometric spacings, 0 for
+// the default of each
+double* makeCoordinates(int size, int stretching, double strength) {
+    long n = size;
+    double* coordinates = malloc(n*sizeof(double));
+
+    if (stretching == STRETCH_TANH) {
+        double factor = strength > 0 ? strength : 2.0;
+        for (long j=0 ; j<n ; j++) {
+            double position = 2.0*j/(n - 1) - 1;
+            coordinates[j] = (1 + tanh(factor*position)/tanh(factor))/2;
+        }
+    } else if (stretching == STRETCH_GEOMETRIC) {
+        // spacing k is ratio^(intervals from the nearest end), then scaled so
+        // that the spacings add up to 1
+        double ratio = strength > 0 ? strength : 1.05;
+        coordinates[0] = 0.0;
+        for (long k=0 ; k<n-1 ; k++) {
+            long from_end = k < n - 2 - k ? k : n - 2 - k;
+            coordinates[k + 1] = coordinates[k] + pow(ratio, from_end);
+        }
+        double length = coordinates[n - 1];
+        for (long j=0 ; j<n ; j++) {
+            coordinates[j] /= length;
+        }
+    } else {
+        for (long j=0 ; j<n ; j++) {
+            coordinates[j] = (double)j/(n - 1);
+        }
+    }
+    return coordinates;
+}
+
+// Returns the coordinates read from a file holding matrix_size column
+// coordinates followed by matrix_size row coordinates, separated by white
+// space, or NULL if the file can't be read or an axis doesn't strictly
+// increase
+double* loadCoordinates(char* file_name) {
+    FILE* file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Could not open '%s'\n", file_name);
+        return NULL;
+    }
+
+    long n = matrix_size;
+    double* coordinates = malloc(2*n*sizeof(double));
+    for (long k=0 ; k<2*n ; k++) {
+        if (fscanf(file, "%lf", &coordinates[k]) != 1) {
+            printf("'%s' doesn't hold %ld coordinates per axis\n", file_name, n);
+            free(coordinates);
+            fclose(file);
+            return NULL;
+        }
+        if (k%n != 0 && !(coordinates[k] > coordinates[k - 1])) {
+            printf("'%s' holds coordinates that don't increase\n", file_name);
+            free(coordinates);
+            fclose(file);
+            return NULL;
+        }
+    }
+
+    fclose(file);
+    return coordinates;
+}
+
+// Fills before and after with the weights of the neighbours before and after
+// each interior point of an axis with the given coordinates
+void getAxisWeights(double* coordinates, long n, double* before, double* after) {
+    before[0] = after[0] = 0.0;
+    before[n - 1] = after[n - 1] = 0.0;
+    for (long j=1 ; j<n-1 ; j++) {
+        double before_spacing = coordinates[j] - coordinates[j - 1];
+        double after_spacing = coordinates[j + 1] - coordinates[j];
+        double span = before_spacing + after_spacing;
+        before[j] = 2/(before_spacing*span);
+        after[j] = 2/(after_spacing*span);
+    }
+}
+
+// Pool task, one sweep over the worker's share of rows
+void stretchedSweepTask(int worker, int worker_count, void* arg) {
+    STRETCHED_SOLVE* solve = (STRETCHED_SOLVE*)arg;
+    long n = solve->size;
+    const double* west = solve->west;
+    const double* east = solve->east;
+    double threshold = decimal_value;
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        const double* up = &solve->values[(i - 1)*n];
+        const double* row = &solve->values[i*n];
+        const double* down = &solve->values[(i + 1)*n];
+        double* out = &solve->new_values[i*n];
+        double north = solve->north[i];
+        double south = solve->south[i];
+        double vertical = north + south;
+
+        for (long j=1 ; j<n-1 ; j++) {
+            double new_value = (west[j]*row[j - 1] + east[j]*row[j + 1] + north*up[j] + south*down[j])
+                    /(west[j] + east[j] + vertical);
+            changed |= fabs(new_value - row[j]) > threshold;
+            out[j] = new_value;
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// One sweep over the whole grid, the map Anderson acceleration iterates
+void stretchedSweep(void* arg) {
+    runPool(stretchedSweepTask, arg);
+}
+
+// Relaxes grid, a size*size matrix whose columns sit at x and rows at y, until
+// no value changes by more than decimal_value. The sweeps are Anderson
+// accelerated over the last history iterates if history is above 0. Must be
+// called with the pool started.
+void relaxStretched(double* grid, int size, double* x, double* y, int history, int worker_count) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+
+    STRETCHED_SOLVE solve;
+    solve.size = n;
+    solve.changed = 0;
+    solve.west = malloc(n*sizeof(double));
+    solve.east = malloc(n*sizeof(double));
+    solve.north = malloc(n*sizeof(double));
+    solve.south = malloc(n*sizeof(double));
+    getAxisWeights(x, n, solve.west, solve.east);
+    getAxisWeights(y, n, solve.north, solve.south);
+
+    solve.values = malloc(n*n*sizeof(double));
+    solve.new_values = malloc(n*n*sizeof(double));
+    memcpy(solve.values, grid, n*n*sizeof(double));
+    memcpy(solve.new_values, grid, n*n*sizeof(double));
+
+    if (history > 0) {
+        FIXED_POINT_MAP map = {stretchedSweep, &solve, &solve.values, &solve.new_values, 1};
+        accelerateAnderson(&map, n*n, decimal_value, history, worker_count);
+    } else {
+        while (1) {
+            runPool(stretchedSweepTask, &solve);
+            double* swap = solve.values;
+            solve.values = solve.new_values;
+            solve.new_values = swap;
+
+            if (!solve.changed) {
+                break;
+            }
+            solve.changed = 0;
+        }
+    }
+
+    memcpy(grid, solve.values, n*n*sizeof(double));
+    free(solve.values);
+    free(solve.new_values);
+    free(solve.west);
+    free(solve.east);
+    free(solve.north);
+    free(solve.south);
+}
@@ -0,0 +1,288 @@
+/**
+* Superposition of cached basis solutions
+* Oliver Redeyoff
+*
+* The Laplace problem is linear in its edge values, so when each edge is split
+* into segments, a problem whose edges are constant on every segment has as its
+* solution the sum of one basis solution per segment, weighted by its value.
+* The basis solution of a segment has 1 on that segment and 0 on the rest of
+* the edges:
+*
+* 1 - the basis is solved once per matrix size and segment count with the
+*     fast direct solver. Only the segments of the top edge are solved, the
+*     matrix being square the bottom edge's are their vertical mirror images
+*     and the left and right edges' the transposes of the top and bottom
+*     edges'. The basis is kept in
+*     memory for the rest of the run and, when a cache directory is given,
+*     written to disk so that later runs skip the solves entirely
+*
+* 2 - every scenario then only costs the weighted sum. Each worker builds its
+*     share of rows from the top and bottom terms, and in a scratch matrix the
+*     left and right terms, which come out transposed. After the workers meet,
+*     each one adds its share of the transposed scratch matrix in tiles
+*
+* The weight of a segment is the average of the scenario's edge cells on it, so
+* edges that vary within a segment get the solution for their segment
+* averages. The corner cells are never read by the 5 point stencil and so are
+* no part of any segment.
+*
+**/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "relaxation_technique.h"
+
+// identifies basis files, changed whenever their layout changes
+#define SUPERPOSITION_FILE_MAGIC "RLXSUPR1"
+
+// side of the tiles the scratch matrix is transposed in
+#define TRANSPOSE_TILE 32
+
+// basis already solved or loaded during this run
+SUPERPOSITION_BASIS* basis_cache = NULL;
+
+// state shared with the pool tasks of one scenario
+typedef struct superposition_solve {
+    SUPERPOSITION_BASIS* basis;
+    double* grid;
+    double* scratch;        // left and right terms, transposed
+    double* weights;        // per segment, top then bottom, left and right
+} SUPERPOSITION_SOLVE;
+
+// Returns 1 if a size*size matrix can be split into the given segments per edge
+int superpositionQualifies(int size, int segments) {
+    return size >= 3 && segments >= 1 && segments <= size - 2;
+}
+
+// Returns the path of the basis file for a matrix size and segment count in
+// cache_directory
+void getBasisPath(char* path, int length, char* cache_directory, int size, int segments) {
+    snprintf(path, length, "%s/superposition_%d_%d.bin", cache_directory, size, segments);
+}
+
+// Reads a basis from the disk cache, returns NULL if it isn't there or doesn't
+// match the matrix size and segment count
+SUPERPOSITION_BASIS* readBasis(char* cache_directory, int size, int segments) {
+    char path[4096];
+    getBasisPath(path, sizeof(path), cache_directory, size, segments);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    char magic[8];
+    int shape[2];
+    SUPERPOSITION_BASIS* basis = NULL;
+
+    if (fread(magic, 1, 8, file) == 8 && memcmp(magic, SUPERPOSITION_FILE_MAGIC, 8) == 0
+            && fread(shape, sizeof(int), 2, file) == 2 && shape[0] == size && shape[1] == segments) {
+        basis = malloc(sizeof(SUPERPOSITION_BASIS));
+        basis->size = size;
+        basis->segments = segments;
+
+        long count = (long)segments*size*size;
+        basis->solutions = malloc(count*sizeof(double));
+        if (fread(basis->solutions, sizeof(double), count, file) != (size_t)count) {
+            free(basis->solutions);
+            free(basis);
+            basis = NULL;
+        }
+    }
+
+    fclose(file);
+    return basis;
+}
+
+// Writes a basis to the disk cache, creating the directory if needed
+void writeBasis(char* cache_directory, SUPERPOSITION_BASIS* basis) {
+    if (mkdir(cache_directory, 0755) != 0 && errno != EEXIST) {
+        printf("Could not create cache directory '%s'\n", cache_directory);
+        return;
+    }
+
+    char path[4096];
+    getBasisPath(path, sizeof(path), cache_directory, basis->size, basis->segments);
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Could not open '%s' for writing\n", path);
+        return;
+    }
+
+    int shape[2] = {basis->size, basis->segments};
+    fwrite(SUPERPOSITION_FILE_MAGIC, 1, 8, file);
+    fwrite(shape, sizeof(int), 2, file);
+    fwrite(basis->solutions, sizeof(double), (long)basis->segments*basis->size*basis->size, file);
+    fclose(file);
+}
+
+// Returns the basis for a size*size matrix with the given segments per edge,
+// from the memory cache, the disk cache in cache_directory (may be NULL) or by
+// solving it. Must be called with the pool started.
+SUPERPOSITION_BASIS* getSuperpositionBasis(int size, int segments, char* cache_directory) {
+    for (SUPERPOSITION_BASIS* basis=basis_cache ; basis!=NULL ; basis=basis->next) {
+        if (basis->size == size && basis->segments == segments) {
+            return basis;
+        }
+    }
+
+    SUPERPOSITION_BASIS* basis = NULL;
+    if (cache_directory != NULL) {
+        basis = readBasis(cache_directory, size, segments);
+    }
+
+    if (basis == NULL) {
+        long n = size;
+        basis = malloc(sizeof(SUPERPOSITION_BASIS));
+        basis->size = size;
+        basis->segments = segments;
+        basis->solutions = calloc((long)segments*n*n, sizeof(double));
+
+        // 1 on the segment of the top edge, 0 on every other edge cell
+        for (int s=0 ; s<segments ; s++) {
+            double* solution = &basis->solutions[s*n*n];
+            long start, end;
+            splitRange(s, segments, n - 2, &start, &end);
+            for (long j=start+1 ; j<end+1 ; j++) {
+                solution[j] = 1.0;
+            }
+            solveDirect(solution, size, size);
+        }
+
+        if (cache_directory != NULL) {
+            writeBasis(cache_directory, basis);
+        }
+    }
+
+    basis->next = basis_cache;
+    basis_cache = basis;
+    return basis;
+}
+
+// Frees every basis in the memory cache
+void freeSuperpositionBases() {
+    while (basis_cache != NULL) {
+        SUPERPOSITION_BASIS* next = basis_cache->next;
+        free(basis_cache->solutions);
+        free(basis_cache);
+        basis_cache = next;
+    }
+}
+
+// Pool task, sets the worker's share of interior rows to the top and bottom
+// terms of the sum, and the same rows of the scratch matrix to the left and
+// right terms before transposition. The left edge's basis at (i, j) is the top
+// edge's at (j, i) and the right edge's is the bottom edge's at (j, i).
+void superposeRowsTask(int worker, int worker_count, void* arg) {
+    SUPERPOSITION_SOLVE* solve = (SUPERPOSITION_SOLVE*)arg;
+    long n = solve->basis->size;
+    int segments = solve->basis->segments;
+    double* weights = solve->weights;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        double* row = &solve->grid[i*n];
+        double* scratch = &solve->scratch[i*n];
+        memset(&row[1], 0, (n - 2)*sizeof(double));
+        memset(&scratch[1], 0, (n - 2)*sizeof(double));
+
+        for (int s=0 ; s<segments ; s++) {
+            double* solution = &solve->basis->solutions[s*n*n];
+            const double* top = &solution[i*n];
+            const double* bottom = &solution[(n - 1 - i)*n];
+            double top_weight = weights[s];
+            double bottom_weight = weights[segments + s];
+            double left_weight = weights[2*segments + s];
+            double right_weight = weights[3*segments + s];
+
+            for (long j=1 ; j<n-1 ; j++) {
+                row[j] += top_weight*top[j] + bottom_weight*bottom[j];
+                scratch[j] += left_weight*top[j] + right_weight*bottom[j];
+            }
+        }
+    }
+}
+
+// Pool task, adds the transposed scratch matrix to the worker's share of
+// interior rows, a tile at a time so the columns read stay in cache
+void superposeTransposeTask(int worker, int worker_count, void* arg) {
+    SUPERPOSITION_SOLVE* solve = (SUPERPOSITION_SOLVE*)arg;
+    long n = solve->basis->size;
+    double* grid = solve->grid;
+    double* scratch = solve->scratch;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long tile_i=start+1 ; tile_i<end+1 ; tile_i+=TRANSPOSE_TILE) {
+        long tile_i_end = tile_i + TRANSPOSE_TILE < end + 1 ? tile_i + TRANSPOSE_TILE : end + 1;
+        for (long tile_j=1 ; tile_j<n-1 ; tile_j+=TRANSPOSE_TILE) {
+            long tile_j_end = tile_j + TRANSPOSE_TILE < n - 1 ? tile_j + TRANSPOSE_TILE : n - 1;
+            for (long i=tile_i ; i<tile_i_end ; i++) {
+                for (long j=tile_j ; j<tile_j_end ; j++) {
+                    grid[i*n + j] += scratch[j*n + i];
+                }
+            }
+        }
+    }
+}
+
+// Sets weights, segments per edge for the top, bottom, left and right edges in
+// turn, to the averages of grid's edge cells over each segment. Returns 1 if
+// some segment's cells differ from its average by more than decimal_value.
+int getSegmentWeights(double* grid, long n, int segments, double* weights) {
+    int varies = 0;
+    for (int edge=0 ; edge<4 ; edge++) {
+        // index of the first interior cell of the edge and the step along it
+        long first = edge == 0 ? 1 : edge == 1 ? (n - 1)*n + 1 : edge == 2 ? n : 2*n - 1;
+        long step = edge < 2 ? 1 : n;
+
+        for (int s=0 ; s<segments ; s++) {
+            long start, end;
+            splitRange(s, segments, n - 2, &start, &end);
+
+            double sum = 0.0;
+            for (long p=start ; p<end ; p++) {
+                sum += grid[first + p*step];
+            }
+            double average = sum/(end - start);
+            for (long p=start ; p<end ; p++) {
+                varies |= fabs(grid[first + p*step] - average) > decimal_value;
+            }
+            weights[edge*segments + s] = average;
+        }
+    }
+    return varies;
+}
+
+// Overwrites the interior of each of the grid_count grids with the weighted sum
+// of the basis solutions for its segment averages. Must be called with the
+// pool started.
+void solveSuperposition(SUPERPOSITION_BASIS* basis, double** grids, int grid_count) {
+    long n = basis->size;
+
+    SUPERPOSITION_SOLVE solve;
+    solve.basis = basis;
+    solve.scratch = malloc(n*n*sizeof(double));
+    solve.weights = malloc(4*basis->segments*sizeof(double));
+
+    for (int g=0 ; g<grid_count ; g++) {
+        if (getSegmentWeights(grids[g], n, basis->segments, solve.weights)) {
+            printf("Edges vary within a segment, solving for the segment averages\n");
+        }
+        solve.grid = grids[g];
+        runPool(superposeRowsTask, &solve);
+        runPool(superposeTransposeTask, &solve);
+    }
+
+    free(solve.scratch);
+    free(solve.weights);
+}
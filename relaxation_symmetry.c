@@ -0,0 +1,242 @@
+/**
+* Symmetry detection and reduced domain relaxation
+* Oliver Redeyoff
+*
+* The converged matrix only depends on the edge cells, so when the edges are
+* symmetric the solution is too and only a fundamental region of it needs to be
+* relaxed:
+*
+* - mirror symmetry about the vertical (or horizontal) centre line keeps the
+*   left (or top) half of the columns (or rows). Cells on the last kept column
+*   read their right neighbour from its mirror image, which is also kept. With
+*   both mirrors only a quarter of the matrix is relaxed.
+*
+* - symmetry about the main diagonal, u(i,j) = u(j,i), as in the default
+*   problem, keeps the lower triangle packed row after row. Cells on the
+*   diagonal read the neighbours above and to the right from their mirror
+*   images to the left and below.
+*
+* The fundamental region is relaxed with the same rule as relaxMatrix (stop
+* once no cell changes by more than decimal_value in a sweep) using 2 buffers
+* shared between the workers of the pool, then the full matrix is rebuilt from
+* it. Work and memory shrink by the same factor as the region, and Anderson
+* acceleration, when asked for, mixes the region alone.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// state shared with the pool tasks of one reduced solve
+typedef struct symmetric_solve {
+    int symmetry;
+    int size;               // cells per side of the full matrix
+    int rows;               // rows of the kept region
+    int cols;               // columns of the kept region, for mirror symmetry
+    double* values;         // region read this sweep
+    double* new_values;     // region written this sweep
+    long* row_starts;       // first row of each worker
+    POOL_TASK sweep;        // kernel of the region's shape
+    int changed;
+} SYMMETRIC_SOLVE;
+
+// Returns the SYMMETRY_* flags for which the edge cells of a size*size grid are
+// symmetric. Corners are ignored as relaxation never reads them.
+int detectSymmetry(double* grid, int size) {
+    long n = size;
+    int vertical = 1;
+    int horizontal = 1;
+    int diagonal = 1;
+
+    for (long k=1 ; k<n-1 ; k++) {
+        double top = grid[k];
+        double bottom = grid[(n - 1)*n + k];
+        double left = grid[k*n];
+        double right = grid[k*n + n - 1];
+
+        // mirror image of each edge cell, the vertical mirror swaps the left
+        // and right edges and flips the top and bottom ones
+        vertical &= left == right && top == grid[n - 1 - k] && bottom == grid[(n - 1)*n + n - 1 - k];
+        horizontal &= top == bottom && left == grid[(n - 1 - k)*n] && right == grid[(n - 1 - k)*n + n - 1];
+        diagonal &= top == left && bottom == right;
+    }
+
+    return (vertical ? SYMMETRY_VERTICAL : 0) | (horizontal ? SYMMETRY_HORIZONTAL : 0) | (diagonal ? SYMMETRY_DIAGONAL : 0);
+}
+
+// Offset of row i of the packed lower triangle
+static inline long triangleRow(long i) {
+    return i*(i + 1)/2;
+}
+
+// Pool task, one Jacobi sweep over the worker's rows of a mirrored region
+void mirroredSweepTask(int worker, int worker_count, void* arg) {
+    SYMMETRIC_SOLVE* solve = (SYMMETRIC_SOLVE*)arg;
+    long n = solve->size;
+    long cols = solve->cols;
+    long rows = solve->rows;
+    int changed = 0;
+
+    // last row and column relaxed, the full matrix's edges stay fixed
+    long last_row = rows < n ? rows - 1 : n - 2;
+    long last_col = cols < n ? cols - 1 : n - 2;
+
+    for (long i=solve->row_starts[worker] ; i<solve->row_starts[worker + 1] ; i++) {
+        if (i < 1 || i > last_row) {
+            continue;
+        }
+
+        // rows past the kept region are mirror images of kept ones
+        long below = i + 1 < rows ? i + 1 : n - 2 - i;
+        double* up = &solve->values[(i - 1)*cols];
+        double* row = &solve->values[i*cols];
+        double* down = &solve->values[below*cols];
+        double* out = &solve->new_values[i*cols];
+
+        long j = 1;
+        for ( ; j<=last_col && j<cols-1 ; j++) {
+            double new_value = (up[j] + row[j + 1] + down[j] + row[j - 1])/4;
+            changed |= fabs(new_value - row[j]) > decimal_value;
+            out[j] = new_value;
+        }
+        if (j == cols - 1 && j <= last_col) {
+            double new_value = (up[j] + row[n - 2 - j] + down[j] + row[j - 1])/4;
+            changed |= fabs(new_value - row[j]) > decimal_value;
+            out[j] = new_value;
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Pool task, one Jacobi sweep over the worker's rows of the lower triangle
+void triangleSweepTask(int worker, int worker_count, void* arg) {
+    SYMMETRIC_SOLVE* solve = (SYMMETRIC_SOLVE*)arg;
+    long n = solve->size;
+    int changed = 0;
+
+    for (long i=solve->row_starts[worker] ; i<solve->row_starts[worker + 1] ; i++) {
+        if (i < 1 || i > n - 2) {
+            continue;
+        }
+
+        double* up = &solve->values[triangleRow(i - 1)];
+        double* row = &solve->values[triangleRow(i)];
+        double* down = &solve->values[triangleRow(i + 1)];
+        double* out = &solve->new_values[triangleRow(i)];
+
+        for (long j=1 ; j<i ; j++) {
+            double new_value = (up[j] + row[j + 1] + down[j] + row[j - 1])/4;
+            changed |= fabs(new_value - row[j]) > decimal_value;
+            out[j] = new_value;
+        }
+
+        // on the diagonal the cell above mirrors the one to the left and the
+        // cell to the right mirrors the one below
+        double new_value = (row[i - 1] + down[i])/2;
+        changed |= fabs(new_value - row[i]) > decimal_value;
+        out[i] = new_value;
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// One sweep over the whole region, the map Anderson acceleration iterates
+void symmetricSweep(void* arg) {
+    SYMMETRIC_SOLVE* solve = (SYMMETRIC_SOLVE*)arg;
+    runPool(solve->sweep, solve);
+}
+
+// Relaxes grid, a size*size matrix whose edges have the given symmetry flags,
+// on its fundamental region only and writes the rebuilt result back into it.
+// The sweeps are Anderson accelerated over the last history iterates if
+// history is above 0. Must be called with the pool started.
+void relaxSymmetric(double* grid, int size, int symmetry, int history, int worker_count) {
+    long n = size;
+    SYMMETRIC_SOLVE solve;
+    solve.size = size;
+    solve.changed = 0;
+    solve.row_starts = malloc((worker_count + 1)*sizeof(long));
+
+    // mirror symmetry is preferred as it can quarter the matrix
+    if (symmetry & (SYMMETRY_VERTICAL | SYMMETRY_HORIZONTAL)) {
+        solve.symmetry = symmetry & (SYMMETRY_VERTICAL | SYMMETRY_HORIZONTAL);
+        solve.rows = solve.symmetry & SYMMETRY_HORIZONTAL ? (size + 1)/2 : size;
+        solve.cols = solve.symmetry & SYMMETRY_VERTICAL ? (size + 1)/2 : size;
+
+        long count = (long)solve.rows*solve.cols;
+        solve.values = malloc(count*sizeof(double));
+        solve.new_values = malloc(count*sizeof(double));
+        for (long i=0 ; i<solve.rows ; i++) {
+            memcpy(&solve.values[i*solve.cols], &grid[i*n], solve.cols*sizeof(double));
+        }
+
+        for (int w=0 ; w<=worker_count ; w++) {
+            long end;
+            splitRange(w, worker_count, solve.rows, &solve.row_starts[w], &end);
+        }
+    } else {
+        solve.symmetry = SYMMETRY_DIAGONAL;
+        solve.rows = size;
+        solve.cols = size;
+
+        long count = triangleRow(n);
+        solve.values = malloc(count*sizeof(double));
+        solve.new_values = malloc(count*sizeof(double));
+        for (long i=0 ; i<n ; i++) {
+            memcpy(&solve.values[triangleRow(i)], &grid[i*n], (i + 1)*sizeof(double));
+        }
+
+        // row i holds i+1 cells, so give each worker an equal share of the
+        // triangle's area rather than of its rows
+        for (int w=0 ; w<=worker_count ; w++) {
+            solve.row_starts[w] = (long)(n*sqrt((double)w/worker_count));
+        }
+        solve.row_starts[worker_count] = n;
+    }
+
+    solve.sweep = solve.symmetry == SYMMETRY_DIAGONAL ? triangleSweepTask : mirroredSweepTask;
+    long count = solve.symmetry == SYMMETRY_DIAGONAL ? triangleRow(n) : (long)solve.rows*solve.cols;
+    memcpy(solve.new_values, solve.values, count*sizeof(double));
+
+    if (history > 0) {
+        FIXED_POINT_MAP map = {symmetricSweep, &solve, &solve.values, &solve.new_values, 1};
+        accelerateAnderson(&map, count, decimal_value, history, worker_count);
+    } else {
+        while (1) {
+            symmetricSweep(&solve);
+            double* swap = solve.values;
+            solve.values = solve.new_values;
+            solve.new_values = swap;
+
+            if (!solve.changed) {
+                break;
+            }
+            solve.changed = 0;
+        }
+    }
+
+    // rebuild the full matrix from the region
+    for (long i=1 ; i<n-1 ; i++) {
+        for (long j=1 ; j<n-1 ; j++) {
+            if (solve.symmetry == SYMMETRY_DIAGONAL) {
+                grid[i*n + j] = i >= j ? solve.values[triangleRow(i) + j] : solve.values[triangleRow(j) + i];
+            } else {
+                long region_i = i < solve.rows ? i : n - 1 - i;
+                long region_j = j < solve.cols ? j : n - 1 - j;
+                grid[i*n + j] = solve.values[region_i*solve.cols + region_j];
+            }
+        }
+    }
+
+    free(solve.values);
+    free(solve.new_values);
+    free(solve.row_starts);
+}
@@ -27,11 +27,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/time.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <unistd.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "relaxation_technique.h"
 
 // declare global variables to store matrix and blocks
@@ -39,9 +44,24 @@ int thread_count;
 int decimal_precision;
 double decimal_value;
 int value_change_flag;
+int relaxation_done;
 int matrix_size;
 double* matrix;
 BLOCK* blocks;
+int stream_stores;
+int multi_row_kernel;
+
+// most matrices read with -i in one run
+#define MAX_INPUT_FILES 64
+
+// cache size assumed for choosing streaming stores when the system can't say
+#define STREAM_DEFAULT_CACHE_SIZE (8L*1024*1024)
+
+// level 1 data cache size assumed for choosing the multi-row kernel
+#define KERNEL_DEFAULT_L1_SIZE (32L*1024)
+
+// solver mode names accepted by -m, in SOLVER_MODE order
+char* solver_mode_names[SOLVER_MODE_COUNT] = {"jacobi", "dst", "banded", "symmetric", "tiles", "graph", "transient", "amr", "lines", "adi", "schwarz", "cacg", "superposition", "southwell", "trapezoids", "nested"};
 
 pthread_barrier_t barrier_1;
 pthread_barrier_t barrier_2;
@@ -49,11 +69,11 @@ pthread_barrier_t barrier_2;
 // Returns array of doubles of length matrix_size^2
 double* makeMatrix() {
     // allocate memory for new matrix of given size
-    double* matrix = malloc(matrix_size*matrix_size*sizeof(double));
+    double* matrix = malloc((size_t)matrix_size*matrix_size*sizeof(double));
 
     // put initial values in matrix
-    for (int i=0 ; i<matrix_size ; i++) {
-        for (int j=0 ; j<matrix_size ; j++){
+    for (long i=0 ; i<matrix_size ; i++) {
+        for (long j=0 ; j<matrix_size ; j++){
 
             // populate with 1.0 if left or top edge, else with 0.0
             if (i==0 || j==0){
@@ -75,39 +95,29 @@ double* makeMatrix() {
 BLOCK* makeBlocks() {
     BLOCK* blocks = malloc(thread_count*sizeof(BLOCK));
 
-    int mutatable_indexes_count = matrix_size*matrix_size - matrix_size*2;
+    long mutatable_indexes_count = (long)matrix_size*matrix_size - (long)matrix_size*2;
 
-    int equal_block_size = ceil((double)mutatable_indexes_count/(double)thread_count);
-    int last_block_size = mutatable_indexes_count%equal_block_size;
-    int equal_block_count = (mutatable_indexes_count-last_block_size) / equal_block_size;
+    // block sizes differ by at most one cell, a block is empty (end_index
+    // before start_index) when there are more threads than cells
+    for(int i=0 ; i<thread_count ; i++) {
+        long start, end;
+        splitRange(i, thread_count, mutatable_indexes_count, &start, &end);
 
-    for(int i=0 ; i<equal_block_count ; i++) {
         BLOCK new_block;
-        new_block.start_index = matrix_size + equal_block_size*i;
-        new_block.end_index = matrix_size + equal_block_size*(i+1) - 1;
+        new_block.start_index = matrix_size + start;
+        new_block.end_index = matrix_size + end - 1;
 
-        double* new_values = malloc((new_block.end_index-new_block.start_index)*sizeof(double));
+        double* new_values = malloc((end - start + 1)*sizeof(double));
         new_block.new_values = new_values;
 
         blocks[i] = new_block;
     }
 
-    if(last_block_size != 0) {
-        BLOCK new_block;
-        new_block.start_index = matrix_size + mutatable_indexes_count - last_block_size;
-        new_block.end_index = matrix_size*matrix_size - matrix_size-1;
-
-        double* new_values = malloc((new_block.end_index-new_block.start_index)*sizeof(double));
-        new_block.new_values = new_values;
-
-        blocks[thread_count-1] = new_block;
-    }
-
     return blocks;
 }
 
 // Returns the average of the four cells surrounding a cell at a given index
-double getSuroundingAverage(int index) {
+double getSuroundingAverage(long index) {
     double top_value = matrix[index - matrix_size];
     double right_value = matrix[index + 1];
     double bottom_value = matrix[index + matrix_size];
@@ -116,28 +126,227 @@ double getSuroundingAverage(int index) {
     return (top_value + right_value + bottom_value + left_value)/4;
 }
 
-// Performs relaxation for range indexes of matrix defined in the given block
-void processBlock(BLOCK* block) {
-    int start_index = block->start_index;
-    int end_index = block->end_index;
+// Returns the size in bytes of the largest cache, or 0 if it isn't known
+long getLastLevelCacheSize() {
+    long size = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    if (size <= 0) {
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+#endif
+    return size > 0 ? size : 0;
+}
+
+// Returns 1 if the blocks should be written with non-temporal stores. Once the
+// matrix and the blocks no longer fit in the last level cache every line of
+// new_values is evicted before it is read back, so loading it before writing
+// it (read for ownership) is wasted traffic.
+int useStreamingStores() {
+    long working_set = 2*(long)matrix_size*matrix_size*sizeof(double);
+    long cache_size = getLastLevelCacheSize();
+    if (cache_size == 0) {
+        cache_size = STREAM_DEFAULT_CACHE_SIZE;
+    }
+    return working_set > cache_size;
+}
+
+// Returns 1 if whole rows should go through the multi-row kernel. While the 3
+// rows read and the row written by relaxSegment fit in the level 1 cache its
+// extra loads hit there and it is the faster kernel, past that every reload
+// comes from further out and loading each row once per pass wins.
+int useMultiRowKernel() {
+    long l1_size = 0;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    l1_size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+#endif
+    if (l1_size <= 0) {
+        l1_size = KERNEL_DEFAULT_L1_SIZE;
+    }
+    return 4*(long)matrix_size*(long)sizeof(double) > l1_size;
+}
 
-    for(int m_i=start_index ; m_i<=end_index ; m_i++) {
+// Returns the average of the four cells surrounding cell, in a matrix of n
+// cells per side, summed in the order getSuroundingAverage uses
+static inline double averageAround(const double* cell, long n) {
+    return (cell[-n] + cell[1] + cell[n] + cell[-1])/4;
+}
 
-        // get index for block new values
-        int b_i = m_i-start_index;
+// Relaxes count cells of matrix, n cells per side, from index into new_values,
+// returns 1 if one of them changed by more than decimal_value. The previous
+// value is read from the matrix rather than new_values so the kernel never
+// reads the block. A matrix read with -i can start on either side of its
+// solution, so the change test is on the absolute difference.
+static inline int relaxSegment(double* new_values, long index, long count, long n) {
+    const double* cells = &matrix[index];
+    int changed = 0;
+    long k = 0;
 
-        // keep any edge value as is
-        if (m_i%matrix_size != 0 && (m_i+1)%matrix_size != 0) {
-            double new_value = getSuroundingAverage(m_i);
-            double diff = new_value - block->new_values[b_i];
-            if (diff > decimal_value) {
-                value_change_flag = 1;
+#ifdef __SSE2__
+    if (stream_stores) {
+        // peel until the destination is 16 byte aligned, then stream pairs
+        for ( ; k<count && ((uintptr_t)&new_values[k] & 15) != 0 ; k++) {
+            double new_value = averageAround(&cells[k], n);
+            changed |= fabs(new_value - cells[k]) > decimal_value;
+            new_values[k] = new_value;
+        }
+        for ( ; k+1<count ; k+=2) {
+            double first = averageAround(&cells[k], n);
+            double second = averageAround(&cells[k + 1], n);
+            changed |= fabs(first - cells[k]) > decimal_value;
+            changed |= fabs(second - cells[k + 1]) > decimal_value;
+            _mm_stream_pd(&new_values[k], _mm_set_pd(second, first));
+        }
+    }
+#endif
+
+    for ( ; k<count ; k++) {
+        double new_value = averageAround(&cells[k], n);
+        changed |= fabs(new_value - cells[k]) > decimal_value;
+        new_values[k] = new_value;
+    }
+
+    return changed;
+}
+
+// Relaxes KERNEL_ROWS whole rows of n cells, the first at in, into out. Each
+// column loads the KERNEL_ROWS+2 rows it touches once and every loaded value
+// serves as the centre of one cell and the vertical neighbour of the cells
+// above and below, where relaxSegment loads it three times over three rows.
+// The rows the next pass reads for the first time are prefetched
+// PREFETCH_DISTANCE cells ahead, KERNEL_CHUNK columns at a time since the
+// prefetches would stop the column loop from being vectorised. Returns 1 if a
+// cell changed by more than threshold.
+static inline int relaxPass(const double* restrict in, double* restrict out, long n, double threshold) {
+    int changed = 0;
+
+    for (int k=0 ; k<KERNEL_ROWS ; k++) {
+        out[k*n] = in[k*n];
+        out[k*n + n - 1] = in[k*n + n - 1];
+    }
+
+    for (long chunk=1 ; chunk<n-1 ; chunk+=KERNEL_CHUNK) {
+#if PREFETCH_DISTANCE > 0
+        for (int k=KERNEL_ROWS+1 ; k<=2*KERNEL_ROWS ; k++) {
+            for (int line=0 ; line<KERNEL_CHUNK ; line+=8) {
+                __builtin_prefetch(&in[k*n + chunk + line + PREFETCH_DISTANCE], 0, 3);
             }
-            block->new_values[b_i] = new_value;
-        } else {
-            block->new_values[b_i] = matrix[m_i];
         }
+#endif
+
+        long chunk_end = chunk + KERNEL_CHUNK < n - 1 ? chunk + KERNEL_CHUNK : n - 1;
+        for (long j=chunk ; j<chunk_end ; j++) {
+            double centre_0 = in[j];
+            double centre_1 = in[n + j];
+            double centre_2 = in[2*n + j];
+            double centre_3 = in[3*n + j];
+
+            double new_0 = (in[j - n] + in[j + 1] + centre_1 + in[j - 1])/4;
+            double new_1 = (centre_0 + in[n + j + 1] + centre_2 + in[n + j - 1])/4;
+            double new_2 = (centre_1 + in[2*n + j + 1] + centre_3 + in[2*n + j - 1])/4;
+            double new_3 = (centre_2 + in[3*n + j + 1] + in[4*n + j] + in[3*n + j - 1])/4;
 
+            changed |= fabs(new_0 - centre_0) > threshold;
+            changed |= fabs(new_1 - centre_1) > threshold;
+            changed |= fabs(new_2 - centre_2) > threshold;
+            changed |= fabs(new_3 - centre_3) > threshold;
+            out[j] = new_0;
+            out[n + j] = new_1;
+            out[2*n + j] = new_2;
+            out[3*n + j] = new_3;
+        }
+    }
+
+    return changed;
+}
+
+// Relaxes rows whole rows of matrix, n cells per side, starting at index, the
+// first cell of a row, into new_values, KERNEL_ROWS rows per pass. Returns 1 if
+// a cell changed by more than decimal_value.
+static inline int relaxRows(double* new_values, long index, long rows, long n) {
+    int changed = 0;
+
+    for (long r=0 ; r<rows ; r+=KERNEL_ROWS) {
+        changed |= relaxPass(&matrix[index + r*n], &new_values[r*n], n, decimal_value);
+    }
+
+    return changed;
+}
+
+// Relaxes the block's range of matrix, n cells per side, returns 1 if a cell
+// changed by more than decimal_value. Always inlined so that processBlock can
+// instantiate it with n as a constant.
+static inline __attribute__((always_inline)) int relaxBlock(BLOCK* block, long n) {
+    long start_index = block->start_index;
+    long end_index = block->end_index;
+    int changed = 0;
+
+    // walk the block one row segment at a time, so the column is only
+    // computed once per row and the inner loop has no edge tests
+    long m_i = start_index;
+    while (m_i <= end_index) {
+        long column = m_i%n;
+        long row_end = m_i - column + n - 1;
+        long segment_end = end_index + 1 < row_end ? end_index + 1 : row_end;
+
+        // whole rows go through the multi-row kernel while enough are left.
+        // It writes with plain stores even when the rest of the block is
+        // streamed, loading each row once saves more than streaming does
+        long full_rows = (end_index + 1 - m_i)/n;
+        if (column == 0 && full_rows >= KERNEL_ROWS && multi_row_kernel) {
+            long rows = full_rows - full_rows%KERNEL_ROWS;
+            changed |= relaxRows(&block->new_values[m_i-start_index], m_i, rows, n);
+            m_i += rows*n;
+            continue;
+        }
+
+        // keep any edge value as is
+        if (column == 0) {
+            block->new_values[m_i-start_index] = matrix[m_i];
+            m_i++;
+        }
+
+        changed |= relaxSegment(&block->new_values[m_i-start_index], m_i, segment_end - m_i, n);
+        m_i = segment_end;
+
+        if (m_i == row_end && m_i <= end_index) {
+            block->new_values[m_i-start_index] = matrix[m_i];
+            m_i++;
+        }
+    }
+
+#ifdef __SSE2__
+    // streamed stores are weakly ordered, make them visible before the block
+    // is handed over at the barrier
+    if (stream_stores) {
+        _mm_sfence();
+    }
+#endif
+
+    return changed;
+}
+
+// Performs relaxation for range indexes of matrix defined in the given block.
+// Sizes in FIXED_SIZE_LIST, set by the makefile's FIXED_SIZES, get their own
+// copy of the kernels with the size as a constant, so row strides become
+// immediates and the segment arithmetic divides by a constant.
+KERNEL_TARGETS void processBlock(BLOCK* block) {
+    int changed;
+
+    switch (matrix_size) {
+#ifdef FIXED_SIZE_LIST
+#define FIXED_SIZE(size) case size: changed = relaxBlock(block, size); break;
+    FIXED_SIZE_LIST
+#undef FIXED_SIZE
+#endif
+    default:
+        changed = relaxBlock(block, matrix_size);
+    }
+
+    if (changed) {
+        value_change_flag = 1;
     }
 
 }
@@ -145,19 +354,26 @@ void processBlock(BLOCK* block) {
 // Updates matrix with values stored in each block's new_value array
 void updateMatrix() {
     for (int i=0 ; i<thread_count ; i++) {
-        int start_index = blocks[i].start_index;
-        int end_index = blocks[i].end_index;
-
-        for(int m_i=start_index ; m_i<=end_index ; m_i++) {
-        
-            // get index for block new values
-            int b_i = m_i-start_index;
-            
-            // map block new_values to matrix values
-            if (m_i%matrix_size != 0 && (m_i+1)%matrix_size != 0) {
-                matrix[m_i] = blocks[i].new_values[b_i];
-            }
+        long start_index = blocks[i].start_index;
+        long end_index = blocks[i].end_index;
 
+        // map block new_values to matrix values, a row segment at a time
+        // skipping the edge cells
+        long m_i = start_index;
+        while (m_i <= end_index) {
+            long column = m_i%matrix_size;
+            long row_end = m_i - column + matrix_size - 1;
+            long segment_end = end_index + 1 < row_end ? end_index + 1 : row_end;
+
+            if (column == 0) {
+                m_i++;
+            }
+            for ( ; m_i<segment_end ; m_i++) {
+                matrix[m_i] = blocks[i].new_values[m_i-start_index];
+            }
+            if (m_i == row_end && m_i <= end_index) {
+                m_i++;
+            }
         }
     }
 }
@@ -169,14 +385,14 @@ void printMatrixBlocks() {
     for (int i=0 ; i<matrix_size ; i++) {
         printf("\n");
         for (int j=0 ; j<matrix_size ; j++){
-            int index = i*matrix_size + j;
+            long index = (long)i*matrix_size + j;
 
             for(int q=0 ; q<thread_count ; q++) {
                 if(index >= blocks[q].start_index && index <= blocks[q].end_index) {
                     printf("%s", colors[q%5]);
                 }
             }
-            printf("%f\033[0m, ", matrix[i*matrix_size + j]);
+            printf("%f\033[0m, ", matrix[index]);
         }
     }
     printf("\n\n");
@@ -187,12 +403,53 @@ void printBlocks() {
     printf("\n\n");
     for (int i=0 ; i<thread_count ; i++) {
         printf("Block %d:\n", i);
-        printf("    \033[0;32mStart index :\033[0m %d\n", blocks[i].start_index);
-        printf("    \033[0;31mEnd index :\033[0m %d\n", blocks[i].end_index);
+        printf("    \033[0;32mStart index :\033[0m %ld\n", blocks[i].start_index);
+        printf("    \033[0;31mEnd index :\033[0m %ld\n", blocks[i].end_index);
         printf("\n\n");
     }
 }
 
+// Returns array of doubles of length matrix_size^2 read from a file written by
+// writeMatrix, or NULL if the file can't be read or is too short
+double* loadMatrix(char* file_name) {
+    FILE* file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Could not open '%s' for reading\n", file_name);
+        return NULL;
+    }
+
+    long count = (long)matrix_size*matrix_size;
+    double* values = malloc((size_t)count*sizeof(double));
+    for (long i=0 ; i<count ; i++) {
+        if (fscanf(file, "%lf", &values[i]) != 1) {
+            printf("'%s' holds fewer than %ld values\n", file_name, count);
+            free(values);
+            values = NULL;
+            break;
+        }
+    }
+    fclose(file);
+    return values;
+}
+
+// Writes a matrix_size^2 array to a file, one row per line with values
+// separated by spaces
+void writeMatrix(char* file_name, double* values) {
+    FILE* file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Could not open '%s' for writing\n", file_name);
+        return;
+    }
+
+    for (long i=0 ; i<matrix_size ; i++) {
+        for (long j=0 ; j<matrix_size ; j++) {
+            fprintf(file, j < matrix_size-1 ? "%f " : "%f", values[i*matrix_size + j]);
+        }
+        fputc('\n', file);
+    }
+    fclose(file);
+}
+
 // Entry point for worker thread
 void* initWorkerThread(void* vargp) {
     BLOCK* block = (BLOCK*)vargp;
@@ -207,6 +464,11 @@ void* initWorkerThread(void* vargp) {
 
         // wait to synchronise with main and other work threads at barrier 2
         pthread_barrier_wait(&barrier_2);
+
+        // exit once the main thread has seen the matrix converge
+        if (relaxation_done) {
+            return NULL;
+        }
     }
 }
 
@@ -216,40 +478,26 @@ double getTimeTaken(struct timeval start_time, struct timeval end_time) {
     return res;
 }
 
-int main(int argc, char **argv) {
-
-    // set global variables to passed values
-    if (argc != 4) {
-        printf("Too few arguments\n");
-        return 1;
-    }
-    matrix_size = atoi(argv[1]);
-    thread_count = atoi(argv[2]);
-    decimal_precision = atoi(argv[3]);
-    decimal_value = pow(0.1, decimal_precision);
-
+// Relaxes matrix until no value changes by more than decimal_value, following
+// the strategy described at the top of this file. Adds the time spent in the
+// parallel and sequential phases to the given totals.
+void relaxMatrix(double* sequential_time_taken, double* parallel_time_taken) {
     pthread_t threads[thread_count];
 
-    struct timeval start, end;
-    double time_taken;
     struct timeval parallel_start, parallel_end;
-    double parallel_time_taken;
     struct timeval sequential_start, sequential_end;
-    double sequential_time_taken;
-  
-    // start timer
-    gettimeofday(&start, NULL);
 
-    // instantiate matrix
-    matrix = makeMatrix();
     // instantiate blocks
     blocks = makeBlocks();
+    stream_stores = useStreamingStores();
+    multi_row_kernel = useMultiRowKernel();
 
     // initialise barriers
     pthread_barrier_init(&barrier_1, NULL, thread_count+1);
     pthread_barrier_init(&barrier_2, NULL, thread_count+1);
 
     value_change_flag = 0;
+    relaxation_done = 0;
 
     // create threads
     for (int i=0 ; i<thread_count ; i++) {
@@ -262,7 +510,7 @@ int main(int argc, char **argv) {
         gettimeofday(&parallel_start, NULL);
         pthread_barrier_wait(&barrier_1);
         gettimeofday(&parallel_end, NULL);
-        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+        *parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
 
         gettimeofday(&sequential_start, NULL);
         // check if no value has been changed, if so end program, if not
@@ -283,8 +531,529 @@ int main(int argc, char **argv) {
         // wait to synchronise with worker threads at barrier 2
         gettimeofday(&sequential_end, NULL);
         pthread_barrier_wait(&barrier_2);
+        *sequential_time_taken += getTimeTaken(sequential_start, sequential_end);
+
+    }
+
+    // release the worker threads so they can exit
+    relaxation_done = 1;
+    pthread_barrier_wait(&barrier_2);
+    for (int i=0 ; i<thread_count ; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_barrier_destroy(&barrier_1);
+    pthread_barrier_destroy(&barrier_2);
+    for (int i=0 ; i<thread_count ; i++) {
+        free(blocks[i].new_values);
+    }
+    free(blocks);
+}
+
+// Returns the solver mode with the given name, or -1 if there is none
+int getSolverMode(char* name) {
+    for (int i=0 ; i<SOLVER_MODE_COUNT ; i++) {
+        if (strcmp(name, solver_mode_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void printUsage() {
+    printf("Usage: relaxation [options] <matrix size> <thread count> <decimal precision>\n");
+    printf("  -m mode         solver mode, jacobi by default\n");
+    printf("  -i input file   start from a matrix written by -o instead of the default\n");
+    printf("                  problem, the banded and superposition modes accept several\n");
+    printf("                  to solve as a batch\n");
+    printf("  -o output file  write the final matrix, or matrices suffixed .0, .1, ...\n");
+    printf("  -c directory    cache for the factors of the banded mode and the basis\n");
+    printf("                  solutions of the superposition mode\n");
+    printf("  -k depth        ghost rows of the tiles mode, exchanged every depth sweeps\n");
+    printf("  -l layout       storage layout of the matrix while the jacobi mode relaxes it\n");
+    printf("  -g graph file   CSR graph relaxed by the graph mode instead of a matrix, the\n");
+    printf("                  matrix size is then ignored and -o writes the vertex values\n");
+    printf("  -t scheme       time stepping scheme of the transient mode, ftcs by default\n");
+    printf("  -n steps        time steps of the transient mode, 100 by default\n");
+    printf("  -d step length  time step of the transient mode, by default the FTCS\n");
+    printf("                  stability limit for ftcs and 1 for the implicit schemes\n");
+    printf("  -e every        also write the transient mode's matrix every that many\n");
+    printf("                  steps, to the -o file suffixed with the step number\n");
+    printf("  -r levels       refinement levels of the amr mode above its base grid, or\n");
+    printf("                  coarser grids the nested mode solves first, 3 by default,\n");
+    printf("                  the matrix size minus 1 must divide by 2^levels\n");
+    printf("  -a threshold    difference across a cell above which the amr mode refines,\n");
+    printf("                  0.01 by default\n");
+    printf("  -f conductivity conductivity of each cell, in the format written by -o, for\n");
+    printf("                  the jacobi and lines modes, 1 everywhere by default\n");
+    printf("  -y ratio        conductivity between rows over that between columns for\n");
+    printf("                  the jacobi and lines modes, 1 by default\n");
+    printf("  -z direction    lines solved by the lines mode, alternating by default\n");
+    printf("  -w overlap      rows each subdomain of the schwarz mode extends past its\n");
+    printf("                  strip on either side, 8 by default\n");
+    printf("  -x spacing      cells per coarse cell of the schwarz mode's coarse grid\n");
+    printf("                  correction, 8 by default, 0 for none, the matrix size minus\n");
+    printf("                  1 must divide by it\n");
+    printf("  -s steps        conjugate gradient steps per outer iteration of the cacg\n");
+    printf("                  mode, 4 by default\n");
+    printf("  -b segments     segments each edge is split into by the superposition\n");
+    printf("                  mode, one basis solution each, 1 by default\n");
+    printf("  -u stretching   spacing of the columns and rows of the jacobi mode's\n");
+    printf("                  grid, uniform by default\n");
+    printf("  -q strength     tanh factor, 2 by default, or ratio between neighbouring\n");
+    printf("                  geometric spacings, 1.05 by default, of -u\n");
+    printf("  -j coordinates  column then row coordinates of the jacobi mode's grid,\n");
+    printf("                  matrix size of each, instead of -u\n");
+    printf("  -h history      Anderson accelerate the sweeps of the jacobi, symmetric,\n");
+    printf("                  tiles, graph, lines, trapezoids and nested modes over that\n");
+    printf("                  many past iterates, at most %d, 0 (off) by default. The\n", ANDERSON_MAX_HISTORY);
+    printf("                  dst, banded and superposition modes solve directly and\n");
+    printf("                  cacg already combines its past directions, adi changes\n");
+    printf("                  its shift every step and schwarz solves its subdomains to\n");
+    printf("                  a tolerance, so neither repeats one map, transient follows\n");
+    printf("                  the time evolution rather than a fixed point, and amr and\n");
+    printf("                  southwell relax parts of the matrix at a time, never the\n");
+    printf("                  whole iterate together\n");
+    printf("Modes:");
+    for (int i=0 ; i<SOLVER_MODE_COUNT ; i++) {
+        printf(" %s", solver_mode_names[i]);
+    }
+    printf("\n");
+    printf("Time stepping schemes:");
+    for (int i=0 ; i<TRANSIENT_SCHEME_COUNT ; i++) {
+        printf(" %s", transient_scheme_names[i]);
+    }
+    printf("\n");
+    printf("Line directions:");
+    for (int i=0 ; i<LINE_DIRECTION_COUNT ; i++) {
+        printf(" %s", line_direction_names[i]);
+    }
+    printf("\n");
+    printf("Stretchings:");
+    for (int i=0 ; i<STRETCHING_COUNT ; i++) {
+        printf(" %s", stretching_names[i]);
+    }
+    printf("\n");
+    printf("Layouts:");
+    for (int i=0 ; i<LAYOUT_COUNT ; i++) {
+        printf(" %s", layout_names[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+
+    int solver_mode = MODE_JACOBI;
+    char* output_file_name = NULL;
+    char* cache_directory = NULL;
+    int halo_depth = 1;
+    int layout = -1;
+    char* graph_file_name = NULL;
+    int transient_scheme = TRANSIENT_FTCS;
+    long time_steps = 100;
+    double time_step = 0;
+    long output_every = 0;
+    int amr_levels = 3;
+    double amr_threshold = 0.01;
+    char* conductivity_file_name = NULL;
+    double anisotropy = 1.0;
+    int line_direction = LINES_ALTERNATING;
+    int schwarz_overlap = 8;
+    int coarse_spacing = 8;
+    int cacg_steps = 4;
+    int edge_segments = 1;
+    int stretching = STRETCH_UNIFORM;
+    double stretch_strength = 0;
+    char* coordinate_file_name = NULL;
+    int anderson_history = 0;
+    char* input_file_names[MAX_INPUT_FILES];
+    int input_file_count = 0;
+
+    // parse options, they come before the positional arguments
+    int c;
+    while ((c = getopt(argc, argv, "m:i:o:c:k:l:g:t:n:d:e:r:a:f:y:z:w:x:s:b:u:q:j:h:")) != -1) {
+        switch (c) {
+        case 'm':
+            solver_mode = getSolverMode(optarg);
+            if (solver_mode < 0) {
+                printf("Unknown solver mode '%s'\n", optarg);
+                printUsage();
+                return 1;
+            }
+            break;
+
+        case 'i':
+            if (input_file_count == MAX_INPUT_FILES) {
+                printf("At most %d input files can be given\n", MAX_INPUT_FILES);
+                return 1;
+            }
+            input_file_names[input_file_count++] = optarg;
+            break;
+
+        case 'o':
+            output_file_name = optarg;
+            break;
+
+        case 'c':
+            cache_directory = optarg;
+            break;
+
+        case 'k':
+            halo_depth = atoi(optarg);
+            break;
+
+        case 'l':
+            layout = getLayout(optarg);
+            if (layout < 0) {
+                printf("Unknown layout '%s'\n", optarg);
+                printUsage();
+                return 1;
+            }
+            break;
+
+        case 'g':
+            graph_file_name = optarg;
+            break;
+
+        case 't':
+            transient_scheme = getTransientScheme(optarg);
+            if (transient_scheme < 0) {
+                printf("Unknown time stepping scheme '%s'\n", optarg);
+                printUsage();
+                return 1;
+            }
+            break;
+
+        case 'n':
+            time_steps = atol(optarg);
+            break;
+
+        case 'd':
+            time_step = atof(optarg);
+            break;
+
+        case 'e':
+            output_every = atol(optarg);
+            break;
+
+        case 'r':
+            amr_levels = atoi(optarg);
+            break;
+
+        case 'a':
+            amr_threshold = atof(optarg);
+            break;
+
+        case 'f':
+            conductivity_file_name = optarg;
+            break;
+
+        case 'y':
+            anisotropy = atof(optarg);
+            if (!(anisotropy > 0)) {
+                printf("The anisotropy ratio must be positive\n");
+                return 1;
+            }
+            break;
+
+        case 'z':
+            line_direction = getLineDirection(optarg);
+            if (line_direction < 0) {
+                printf("Unknown line direction '%s'\n", optarg);
+                printUsage();
+                return 1;
+            }
+            break;
+
+        case 'w':
+            schwarz_overlap = atoi(optarg);
+            break;
+
+        case 'x':
+            coarse_spacing = atoi(optarg);
+            break;
+
+        case 's':
+            cacg_steps = atoi(optarg);
+            break;
+
+        case 'b':
+            edge_segments = atoi(optarg);
+            break;
+
+        case 'u':
+            stretching = getStretching(optarg);
+            if (stretching < 0) {
+                printf("Unknown stretching '%s'\n", optarg);
+                printUsage();
+                return 1;
+            }
+            break;
+
+        case 'q':
+            stretch_strength = atof(optarg);
+            break;
+
+        case 'j':
+            coordinate_file_name = optarg;
+            break;
+
+        case 'h':
+            anderson_history = atoi(optarg);
+            break;
+
+        default:
+            printUsage();
+            return 1;
+        }
+    }
+
+    // set global variables to passed values
+    if (argc - optind != 3) {
+        printf("Too few arguments\n");
+        printUsage();
+        return 1;
+    }
+    matrix_size = atoi(argv[optind]);
+    thread_count = atoi(argv[optind + 1]);
+    decimal_precision = atoi(argv[optind + 2]);
+    decimal_value = pow(0.1, decimal_precision);
+
+    if (input_file_count > 1 && solver_mode != MODE_BANDED && solver_mode != MODE_SUPERPOSITION) {
+        printf("Only the banded and superposition modes solve several input files at once\n");
+        return 1;
+    }
+    if ((solver_mode == MODE_GRAPH) != (graph_file_name != NULL)) {
+        printf("The graph mode needs a graph file, given with -g, and only it takes one\n");
+        return 1;
+    }
+    int variable_medium = conductivity_file_name != NULL || anisotropy != 1.0;
+    if (variable_medium && !(solver_mode == MODE_JACOBI && layout < 0) && solver_mode != MODE_LINES) {
+        printf("Only the jacobi mode, in row major order, and the lines mode relax a variable medium\n");
+        return 1;
+    }
+    int stretched_grid = stretching != STRETCH_UNIFORM || coordinate_file_name != NULL;
+    if (stretched_grid && !(solver_mode == MODE_JACOBI && layout < 0 && !variable_medium)) {
+        printf("Only the jacobi mode, in row major order and a uniform medium, relaxes a stretched grid\n");
+        return 1;
+    }
+    int accelerated_mode = solver_mode == MODE_JACOBI || solver_mode == MODE_SYMMETRIC || solver_mode == MODE_TILES
+            || solver_mode == MODE_GRAPH || solver_mode == MODE_LINES || solver_mode == MODE_TRAPEZOIDS
+            || solver_mode == MODE_NESTED;
+    if (anderson_history > 0 && !accelerated_mode) {
+        printf("The %s mode is not Anderson accelerated, see -h in the usage\n", solver_mode_names[solver_mode]);
+        return 1;
+    }
+
+    struct timeval start, end;
+    double time_taken;
+    struct timeval parallel_start, parallel_end;
+    struct timeval sequential_start, sequential_end;
+    double parallel_time_taken = 0;
+    double sequential_time_taken = 0;
+  
+    // start timer
+    gettimeofday(&start, NULL);
+
+    // instantiate matrices, the default problem unless input files are given,
+    // or the graph in graph mode
+    double* grids[MAX_INPUT_FILES];
+    int grid_count = solver_mode == MODE_GRAPH ? 0 : input_file_count > 0 ? input_file_count : 1;
+    for (int i=0 ; i<grid_count ; i++) {
+        grids[i] = input_file_count > 0 ? loadMatrix(input_file_names[i]) : makeMatrix();
+        if (grids[i] == NULL) {
+            return 1;
+        }
+    }
+    matrix = grid_count > 0 ? grids[0] : NULL;
+
+    double* conductivity = NULL;
+    if (conductivity_file_name != NULL) {
+        conductivity = loadConductivity(conductivity_file_name);
+        if (conductivity == NULL) {
+            return 1;
+        }
+    }
+
+    double* x = NULL;
+    double* y = NULL;
+    if (coordinate_file_name != NULL) {
+        x = loadCoordinates(coordinate_file_name);
+        if (x == NULL) {
+            return 1;
+        }
+        y = x + matrix_size;
+    } else if (stretched_grid) {
+        x = makeCoordinates(matrix_size, stretching, stretch_strength);
+        y = x;
+    }
+
+    GRAPH* graph = NULL;
+    if (solver_mode == MODE_GRAPH) {
+        graph = loadGraph(graph_file_name);
+        if (graph == NULL) {
+            return 1;
+        }
+    }
+
+    // mirror symmetries of the edges, 0 if there are none or the mode doesn't
+    // use them
+    int symmetry = solver_mode == MODE_SYMMETRIC ? detectSymmetry(matrix, matrix_size) : 0;
+
+    // the other modes fall back to relaxation when the problem doesn't suit them
+    if (solver_mode == MODE_GRAPH) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxGraph(graph, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_TRANSIENT) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        runTransient(matrix, matrix_size, transient_scheme, time_steps, time_step, output_every, output_file_name);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_AMR && amrQualifies(matrix_size, amr_levels)) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxAmr(matrix, matrix_size, amr_levels, amr_threshold);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_DST && dstQualifies()) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        solveDirect(matrix, matrix_size, matrix_size);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_BANDED && bandedQualifies()) {
+        // the factorisation (or cache lookup) is sequential, the batch of
+        // substitutions is shared between the workers a grid at a time, so a
+        // single grid's substitutions are sequential too
+        gettimeofday(&sequential_start, NULL);
+        BANDED_FACTOR* factor = getBandedFactor(matrix_size, matrix_size, cache_directory);
+        gettimeofday(&sequential_end, NULL);
+        sequential_time_taken += getTimeTaken(sequential_start, sequential_end);
+        if (factor == NULL) {
+            return 1;
+        }
+
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        solveBanded(factor, grids, grid_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        if (grid_count > 1) {
+            parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+        } else {
+            sequential_time_taken += getTimeTaken(parallel_start, parallel_end);
+        }
+        freeBandedFactors();
+    } else if (solver_mode == MODE_SUPERPOSITION && superpositionQualifies(matrix_size, edge_segments)) {
+        // the basis solves (or cache lookup) happen once per matrix size and
+        // are timed apart, the sums answering the scenarios are what is left
+        startPool(thread_count);
+        gettimeofday(&sequential_start, NULL);
+        SUPERPOSITION_BASIS* basis = getSuperpositionBasis(matrix_size, edge_segments, cache_directory);
+        gettimeofday(&sequential_end, NULL);
         sequential_time_taken += getTimeTaken(sequential_start, sequential_end);
 
+        gettimeofday(&parallel_start, NULL);
+        solveSuperposition(basis, grids, grid_count);
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+        stopPool();
+        freeSuperpositionBases();
+    } else if (solver_mode == MODE_SYMMETRIC && symmetry != 0) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxSymmetric(matrix, matrix_size, symmetry, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_TILES) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxTiles(matrix, matrix_size, halo_depth, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_LINES) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxLines(matrix, matrix_size, conductivity, anisotropy, line_direction, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_ADI) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxAdi(matrix, matrix_size);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_SCHWARZ) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxSchwarz(matrix, matrix_size, schwarz_overlap, coarse_spacing, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_CACG) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxCacg(matrix, matrix_size, cacg_steps, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_SOUTHWELL) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxSouthwell(matrix, matrix_size);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_NESTED && nestedQualifies(matrix_size, amr_levels)) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxNested(matrix, matrix_size, amr_levels, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_TRAPEZOIDS) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxTrapezoids(matrix, matrix_size, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (solver_mode == MODE_JACOBI && layout >= 0) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxLayout(matrix, matrix_size, layout, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (stretched_grid) {
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxStretched(matrix, matrix_size, x, y, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else if (variable_medium || anderson_history > 0) {
+        // a uniform medium's sweeps are those of relaxMatrix
+        gettimeofday(&parallel_start, NULL);
+        startPool(thread_count);
+        relaxMedium(matrix, matrix_size, conductivity, anisotropy, anderson_history, thread_count);
+        stopPool();
+        gettimeofday(&parallel_end, NULL);
+        parallel_time_taken += getTimeTaken(parallel_start, parallel_end);
+    } else {
+        relaxMatrix(&sequential_time_taken, &parallel_time_taken);
     }
 
     // end timer
@@ -292,9 +1061,24 @@ int main(int argc, char **argv) {
   
     // calculate total time taken by the program
     time_taken = getTimeTaken(start, end);
+
+    if (output_file_name != NULL && graph != NULL) {
+        writeGraph(output_file_name, graph);
+    } else if (output_file_name != NULL && grid_count == 1) {
+        writeMatrix(output_file_name, matrix);
+    } else if (output_file_name != NULL) {
+        for (int i=0 ; i<grid_count ; i++) {
+            char file_name[4096];
+            snprintf(file_name, sizeof(file_name), "%s.%d", output_file_name, i);
+            writeMatrix(file_name, grids[i]);
+        }
+    }
     
-    // print results
-    printf("%d, %f, %f, %f\n", matrix_size, time_taken, sequential_time_taken, parallel_time_taken);
+    // print results, the last column identifies the build variant
+    printf("%d, %f, %f, %f, %s\n", matrix_size, time_taken, sequential_time_taken, parallel_time_taken, BUILD_CONFIG);
+    freeGraph(graph);
+    free(conductivity);
+    free(x);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,15 +1,243 @@
+// name and flags of the build variant, set by the makefile
+#ifndef BUILD_CONFIG
+#define BUILD_CONFIG "unspecified"
+#endif
+
+// portable builds compile the hot kernels once per instruction set and let the
+// loader pick the best one for the machine they run on
+#ifdef KERNEL_CLONES
+#define KERNEL_TARGETS __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define KERNEL_TARGETS
+#endif
+
+// rows relaxed together by the multi-row kernel, and columns between its
+// batches of prefetches
+#define KERNEL_ROWS 4
+#define KERNEL_CHUNK 64
+
+// cells ahead of the current column that the multi-row kernel prefetches the
+// next rows at, tuned to the memory latency of each core, 0 disables it
+#ifndef PREFETCH_DISTANCE
+#if defined(__znver1__) || defined(__znver2__) || defined(__znver3__) || defined(__znver4__)
+#define PREFETCH_DISTANCE 64
+#elif defined(__skylake_avx512__) || defined(__cascadelake__) || defined(__cooperlake__) \
+        || defined(__icelake_server__) || defined(__sapphirerapids__)
+#define PREFETCH_DISTANCE 128
+#else
+#define PREFETCH_DISTANCE 96
+#endif
+#endif
+
+// solver used by the parallel program, selected with -m
+typedef enum solver_mode {
+    MODE_JACOBI,
+    MODE_DST,
+    MODE_BANDED,
+    MODE_SYMMETRIC,
+    MODE_TILES,
+    MODE_GRAPH,
+    MODE_TRANSIENT,
+    MODE_AMR,
+    MODE_LINES,
+    MODE_ADI,
+    MODE_SCHWARZ,
+    MODE_CACG,
+    MODE_SUPERPOSITION,
+    MODE_SOUTHWELL,
+    MODE_TRAPEZOIDS,
+    MODE_NESTED,
+    SOLVER_MODE_COUNT
+} SOLVER_MODE;
+
 typedef struct block {
-    int start_index;
-    int end_index;
+    long start_index;
+    long end_index;
     double* new_values;
 } BLOCK;
 
 double* makeMatrix();
 BLOCK* makeBlocks();
 
-double getSuroundingAverage(int index);
-void processBlock(BLOCK* block);
+double getSuroundingAverage(long index);
+KERNEL_TARGETS void processBlock(BLOCK* block);
+void relaxMatrix(double* sequential_time_taken, double* parallel_time_taken);
 
 void printMatrix();
 void printMatrixBlocks();
-void printBlocks();
\ No newline at end of file
+void printBlocks();
+double* loadMatrix(char* file_name);
+void writeMatrix(char* file_name, double* values);
+
+// globals describing the problem, defined by the program's main file
+extern int thread_count;
+extern double decimal_value;
+extern int matrix_size;
+extern double* matrix;
+
+// worker pool (relaxation_pool.c)
+typedef void (*POOL_TASK)(int worker, int worker_count, void* arg);
+void startPool(int worker_count);
+void runPool(POOL_TASK task, void* arg);
+void stopPool();
+void splitRange(int worker, int worker_count, long count, long* start, long* end);
+
+// fast direct solver (relaxation_dst.c)
+int dstQualifies();
+void solveDirect(double* grid, int rows, int cols);
+
+// banded direct solver with factor caching (relaxation_banded.c), the factor
+// of the largest size takes about 130 MB and 4*10^9 flops to build
+#define BANDED_MAX_SIZE 256
+typedef struct banded_factor {
+    int rows;
+    int cols;
+    int bandwidth;
+    long unknowns;
+    double* band;
+    struct banded_factor* next;
+} BANDED_FACTOR;
+
+int bandedQualifies();
+BANDED_FACTOR* getBandedFactor(int rows, int cols, char* cache_directory);
+void freeBandedFactors();
+void solveBanded(BANDED_FACTOR* factor, double** grids, int grid_count);
+
+// symmetry detection and reduced domain relaxation (relaxation_symmetry.c)
+#define SYMMETRY_VERTICAL 1
+#define SYMMETRY_HORIZONTAL 2
+#define SYMMETRY_DIAGONAL 4
+
+int detectSymmetry(double* grid, int size);
+void relaxSymmetric(double* grid, int size, int symmetry, int history, int worker_count);
+
+// private per-worker tiles with halo exchange (relaxation_tiles.c)
+void relaxTiles(double* grid, int size, int halo_depth, int history, int worker_count);
+
+// pluggable matrix storage layouts (relaxation_layout.c)
+typedef enum layout {
+    LAYOUT_ROW_MAJOR,
+    LAYOUT_TILED,
+    LAYOUT_MORTON,
+    LAYOUT_COUNT
+} LAYOUT;
+
+extern char* layout_names[LAYOUT_COUNT];
+int getLayout(char* name);
+void relaxLayout(double* grid, int size, int layout, int history, int worker_count);
+
+// relaxation over a general sparse graph (relaxation_graph.c)
+typedef struct graph {
+    long vertex_count;
+    long entry_count;       // adjacency entries, each edge appears once per end
+    long* row_offsets;      // neighbours of vertex i are columns[row_offsets[i]..row_offsets[i+1])
+    long* columns;
+    double* weights;        // weight of each adjacency entry, NULL if unweighted
+    char* fixed;            // 1 for vertices that keep their value
+    double* values;
+} GRAPH;
+
+GRAPH* loadGraph(char* file_name);
+void writeGraph(char* file_name, GRAPH* graph);
+void freeGraph(GRAPH* graph);
+void relaxGraph(GRAPH* graph, int history, int worker_count);
+
+// transient heat equation time stepping (relaxation_transient.c)
+typedef enum transient_scheme {
+    TRANSIENT_FTCS,
+    TRANSIENT_EULER,
+    TRANSIENT_CRANK_NICOLSON,
+    TRANSIENT_SCHEME_COUNT
+} TRANSIENT_SCHEME;
+
+extern char* transient_scheme_names[TRANSIENT_SCHEME_COUNT];
+int getTransientScheme(char* name);
+void runTransient(double* grid, int size, int scheme, long steps, double dt, long output_every, char* output_file_name);
+
+// block-structured adaptive mesh refinement (relaxation_amr.c)
+int amrQualifies(int size, int levels);
+void relaxAmr(double* grid, int size, int levels, double threshold);
+
+// Anderson acceleration of fixed point sweeps (relaxation_anderson.c)
+#define ANDERSON_MAX_HISTORY 16
+
+// relaxation sweeps between mixes
+#define ANDERSON_SWEEPS 16
+
+// one application of a fixed point map, run on the calling thread and using
+// the pool as it needs. It reads the iterate at *values and writes its image to
+// *new_values, or updates *values in place if new_values is NULL. Both hold
+// length doubles, and cells the map never writes must match in the two.
+typedef void (*FIXED_POINT_SWEEP)(void* arg);
+typedef struct fixed_point_map {
+    FIXED_POINT_SWEEP sweep;
+    void* arg;
+    double** values;
+    double** new_values;
+    int sweeps;             // relaxation sweeps per application
+} FIXED_POINT_MAP;
+
+void accelerateAnderson(FIXED_POINT_MAP* map, long length, double threshold, int history, int worker_count);
+
+// variable coefficient and anisotropic media (relaxation_medium.c)
+double* loadConductivity(char* file_name);
+void getFaceCoefficients(double* conductivity, int size, double anisotropy, float* east, float* south);
+void relaxMedium(double* grid, int size, double* conductivity, double anisotropy, int history, int worker_count);
+
+// zebra line relaxation with batched tridiagonal solves (relaxation_lines.c)
+typedef enum line_direction {
+    LINES_ROWS,
+    LINES_COLUMNS,
+    LINES_ALTERNATING,
+    LINE_DIRECTION_COUNT
+} LINE_DIRECTION;
+
+extern char* line_direction_names[LINE_DIRECTION_COUNT];
+int getLineDirection(char* name);
+void relaxLines(double* grid, int size, double* conductivity, double anisotropy, int direction, int history, int worker_count);
+
+// alternating direction implicit solver (relaxation_adi.c)
+void relaxAdi(double* grid, int size);
+
+// overlapping additive Schwarz domain decomposition (relaxation_schwarz.c)
+void relaxSchwarz(double* grid, int size, int overlap, int coarse_spacing, int worker_count);
+
+// communication-avoiding s-step conjugate gradients (relaxation_cacg.c)
+void relaxCacg(double* grid, int size, int steps, int worker_count);
+
+// superposition of cached basis solutions (relaxation_superposition.c)
+typedef struct superposition_basis {
+    int size;
+    int segments;           // segments per edge
+    double* solutions;      // one size*size matrix per segment of the top edge
+    struct superposition_basis* next;
+} SUPERPOSITION_BASIS;
+
+int superpositionQualifies(int size, int segments);
+SUPERPOSITION_BASIS* getSuperpositionBasis(int size, int segments, char* cache_directory);
+void freeSuperpositionBases();
+void solveSuperposition(SUPERPOSITION_BASIS* basis, double** grids, int grid_count);
+
+// relaxation on a stretched grid (relaxation_stretched.c)
+typedef enum stretching {
+    STRETCH_UNIFORM,
+    STRETCH_TANH,
+    STRETCH_GEOMETRIC,
+    STRETCHING_COUNT
+} STRETCHING;
+
+extern char* stretching_names[STRETCHING_COUNT];
+int getStretching(char* name);
+double* makeCoordinates(int size, int stretching, double strength);
+double* loadCoordinates(char* file_name);
+void relaxStretched(double* grid, int size, double* x, double* y, int history, int worker_count);
+
+// residual priority (Southwell) relaxation (relaxation_southwell.c)
+void relaxSouthwell(double* grid, int size);
+
+// cache oblivious trapezoidal decomposition of the sweeps (relaxation_trapezoid.c)
+void relaxTrapezoids(double* grid, int size, int history, int worker_count);
+
+// nested iteration from coarser grids (relaxation_nested.c)
+int nestedQualifies(int size, int levels);
+void relaxNested(double* grid, int size, int levels, int history, int worker_count);
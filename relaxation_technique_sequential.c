@@ -44,11 +44,11 @@ BLOCK* blocks;
 // Returns array of doubles of length matrix_size^2
 double* makeMatrix() {
     // allocate memory for new matrix of given size
-    double* matrix = malloc(matrix_size*matrix_size*sizeof(double));
+    double* matrix = malloc((size_t)matrix_size*matrix_size*sizeof(double));
 
     // put initial values in matrix
-    for (int i=0 ; i<matrix_size ; i++) {
-        for (int j=0 ; j<matrix_size ; j++){
+    for (long i=0 ; i<matrix_size ; i++) {
+        for (long j=0 ; j<matrix_size ; j++){
 
             // populate with 1.0 if left or top edge, else with 0.0
             if (i==0 || j==0){
@@ -70,39 +70,29 @@ double* makeMatrix() {
 BLOCK* makeBlocks() {
     BLOCK* blocks = malloc(thread_count*sizeof(BLOCK));
 
-    int mutatable_indexes_count = matrix_size*matrix_size - matrix_size*2;
+    long mutatable_indexes_count = (long)matrix_size*matrix_size - (long)matrix_size*2;
 
-    int equal_block_size = ceil((double)mutatable_indexes_count/(double)thread_count);
-    int last_block_size = mutatable_indexes_count%equal_block_size;
-    int equal_block_count = (mutatable_indexes_count-last_block_size) / equal_block_size;
+    // block sizes differ by at most one cell, a block is empty (end_index
+    // before start_index) when there are more threads than cells
+    for(int i=0 ; i<thread_count ; i++) {
+        long start, end;
+        splitRange(i, thread_count, mutatable_indexes_count, &start, &end);
 
-    for(int i=0 ; i<equal_block_count ; i++) {
         BLOCK new_block;
-        new_block.start_index = matrix_size + equal_block_size*i;
-        new_block.end_index = matrix_size + equal_block_size*(i+1) - 1;
+        new_block.start_index = matrix_size + start;
+        new_block.end_index = matrix_size + end - 1;
 
-        double* new_values = malloc((new_block.end_index-new_block.start_index)*sizeof(double));
+        double* new_values = malloc((end - start + 1)*sizeof(double));
         new_block.new_values = new_values;
 
         blocks[i] = new_block;
     }
 
-    if(last_block_size != 0) {
-        BLOCK new_block;
-        new_block.start_index = matrix_size + mutatable_indexes_count - last_block_size;
-        new_block.end_index = matrix_size*matrix_size - matrix_size-1;
-
-        double* new_values = malloc((new_block.end_index-new_block.start_index)*sizeof(double));
-        new_block.new_values = new_values;
-
-        blocks[thread_count-1] = new_block;
-    }
-
     return blocks;
 }
 
 // Returns the average of the four cells surrounding a cell at a given index
-double getSuroundingAverage(int index) {
+double getSuroundingAverage(long index) {
     double top_value = matrix[index - matrix_size];
     double right_value = matrix[index + 1];
     double bottom_value = matrix[index + matrix_size];
@@ -112,27 +102,43 @@ double getSuroundingAverage(int index) {
 }
 
 // Performs relaxation for range indexes of matrix defined in the given block
-void processBlock(BLOCK* block) {
-    int start_index = block->start_index;
-    int end_index = block->end_index;
+KERNEL_TARGETS void processBlock(BLOCK* block) {
+    long start_index = block->start_index;
+    long end_index = block->end_index;
+    int changed = 0;
+
+    // walk the block one row segment at a time, so the column is only
+    // computed once per row and the inner loop has no edge tests
+    long m_i = start_index;
+    while (m_i <= end_index) {
+        long column = m_i%matrix_size;
+        long row_end = m_i - column + matrix_size - 1;
+        long segment_end = end_index + 1 < row_end ? end_index + 1 : row_end;
 
-    for(int m_i=start_index ; m_i<=end_index ; m_i++) {
+        // keep any edge value as is
+        if (column == 0) {
+            block->new_values[m_i-start_index] = matrix[m_i];
+            m_i++;
+        }
 
-        // get index for block new values
-        int b_i = m_i-start_index;
+        double* new_values = &block->new_values[m_i-start_index];
+        long count = segment_end - m_i;
+        for (long k=0 ; k<count ; k++) {
+            double new_value = getSuroundingAverage(m_i + k);
+            double diff = new_value - new_values[k];
+            changed |= diff > decimal_value;
+            new_values[k] = new_value;
+        }
+        m_i = segment_end;
 
-        // keep any edge value as is
-        if (m_i%matrix_size != 0 && (m_i+1)%matrix_size != 0) {
-            double new_value = getSuroundingAverage(m_i);
-            double diff = new_value - block->new_values[b_i];
-            if (diff > decimal_value) {
-                value_change_flag = 1;
-            }
-            block->new_values[b_i] = new_value;
-        } else {
-            block->new_values[b_i] = matrix[m_i];
+        if (m_i == row_end && m_i <= end_index) {
+            block->new_values[m_i-start_index] = matrix[m_i];
+            m_i++;
         }
+    }
 
+    if (changed) {
+        value_change_flag = 1;
     }
 
 }
@@ -140,19 +146,26 @@ void processBlock(BLOCK* block) {
 // Updates matrix with values stored in each block's new_value array
 void updateMatrix() {
     for (int i=0 ; i<thread_count ; i++) {
-        int start_index = blocks[i].start_index;
-        int end_index = blocks[i].end_index;
-
-        for(int m_i=start_index ; m_i<=end_index ; m_i++) {
-        
-            // get index for block new values
-            int b_i = m_i-start_index;
-            
-            // map block new_values to matrix values
-            if (m_i%matrix_size != 0 && (m_i+1)%matrix_size != 0) {
-                matrix[m_i] = blocks[i].new_values[b_i];
+        long start_index = blocks[i].start_index;
+        long end_index = blocks[i].end_index;
+
+        // map block new_values to matrix values, a row segment at a time
+        // skipping the edge cells
+        long m_i = start_index;
+        while (m_i <= end_index) {
+            long column = m_i%matrix_size;
+            long row_end = m_i - column + matrix_size - 1;
+            long segment_end = end_index + 1 < row_end ? end_index + 1 : row_end;
+
+            if (column == 0) {
+                m_i++;
+            }
+            for ( ; m_i<segment_end ; m_i++) {
+                matrix[m_i] = blocks[i].new_values[m_i-start_index];
+            }
+            if (m_i == row_end && m_i <= end_index) {
+                m_i++;
             }
-
         }
     }
 }
@@ -164,14 +177,14 @@ void printMatrixBlocks() {
     for (int i=0 ; i<matrix_size ; i++) {
         printf("\n");
         for (int j=0 ; j<matrix_size ; j++){
-            int index = i*matrix_size + j;
+            long index = (long)i*matrix_size + j;
 
             for(int q=0 ; q<thread_count ; q++) {
                 if(index >= blocks[q].start_index && index <= blocks[q].end_index) {
                     printf("%s", colors[q%5]);
                 }
             }
-            printf("%f\033[0m, ", matrix[i*matrix_size + j]);
+            printf("%f\033[0m, ", matrix[index]);
         }
     }
     printf("\n\n");
@@ -182,8 +195,8 @@ void printBlocks() {
     printf("\n\n");
     for (int i=0 ; i<thread_count ; i++) {
         printf("Block %d:\n", i);
-        printf("    \033[0;32mStart index :\033[0m %d\n", blocks[i].start_index);
-        printf("    \033[0;31mEnd index :\033[0m %d\n", blocks[i].end_index);
+        printf("    \033[0;32mStart index :\033[0m %ld\n", blocks[i].start_index);
+        printf("    \033[0;31mEnd index :\033[0m %ld\n", blocks[i].end_index);
         printf("\n\n");
     }
 }
@@ -255,8 +268,8 @@ int main(int argc, char **argv) {
     // calculate total time taken by the program
     time_taken = getTimeTaken(start, end);
     
-    // print results
-    printf("%d, %f, %f, %f\n", matrix_size, time_taken, sequential_time_taken, parallel_time_taken);
+    // print results, the last column identifies the build variant
+    printf("%d, %f, %f, %f, %s\n", matrix_size, time_taken, sequential_time_taken, parallel_time_taken, BUILD_CONFIG);
 
     return 0;
 }
\ No newline at end of file
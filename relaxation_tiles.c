@@ -0,0 +1,222 @@
+/**
+* Relaxation on private per-worker tiles with halo exchange
+* Oliver Redeyoff
+*
+* In relaxMatrix every thread reads the shared matrix and the cache lines at
+* the edges of each block move between cores every sweep. Here each worker owns
+* a strip of rows instead, in a tile it allocates and fills itself (so it is
+* placed in the worker's local memory), padded with halo_depth ghost rows above
+* and below:
+*
+* 1 - each worker relaxes its tile halo_depth times without synchronising. The
+*     rows it recomputes shrink by one each sweep, from its strip plus
+*     halo_depth-1 ghost rows down to just its strip, so the strip is exact
+*     after the last sweep even though the ghost rows were not refreshed
+*
+* 2 - after the workers meet, each one copies the halo_depth rows on either
+*     side of its strip from the tiles of the workers that own them
+*
+* A halo depth of 1 matches the Jacobi sweeps of relaxMatrix exactly. Deeper
+* halos trade some redundant work on the ghost rows for fewer meetings. The
+* stop rule is the one of relaxMatrix applied to the last sweep of each batch.
+*
+* Anderson acceleration needs the whole iterate in one place, so when it is
+* asked for each batch instead refills the tiles from the matrix, halos
+* included, and stores the strips back into it once the workers meet.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// a worker's private tile, aligned so that workers don't share cache lines
+typedef struct tile {
+    long owned_start;       // first global row of the worker's strip
+    long owned_end;         // row after its last one
+    long first_row;         // global row of tile row 0
+    long rows;              // rows in the tile, strip plus both halos
+    double* values;         // tile read this sweep
+    double* new_values;     // tile written this sweep
+    int changed;
+} __attribute__((aligned(64))) TILE;
+
+// state shared with the pool tasks of one solve
+typedef struct tiles_solve {
+    double* grid;
+    long size;
+    int halo_depth;
+    int worker_count;
+    TILE* tiles;
+} TILES_SOLVE;
+
+// Returns the worker whose strip holds an interior global row
+int getRowOwner(TILES_SOLVE* solve, long row) {
+    int worker = 0;
+    while (row >= solve->tiles[worker].owned_end) {
+        worker++;
+    }
+    return worker;
+}
+
+// Pool task, allocates and fills the worker's tile from the grid
+void initTileTask(int worker, int worker_count, void* arg) {
+    TILES_SOLVE* solve = (TILES_SOLVE*)arg;
+    TILE* tile = &solve->tiles[worker];
+    long n = solve->size;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+    tile->owned_start = start + 1;
+    tile->owned_end = end + 1;
+    tile->first_row = tile->owned_start - solve->halo_depth;
+    tile->rows = tile->owned_end - tile->owned_start + 2*solve->halo_depth;
+    tile->values = malloc(tile->rows*n*sizeof(double));
+    tile->new_values = malloc(tile->rows*n*sizeof(double));
+    tile->changed = 0;
+
+    // rows outside the grid are never read, leave them zeroed
+    for (long t=0 ; t<tile->rows ; t++) {
+        long row = tile->first_row + t;
+        if (row >= 0 && row < n) {
+            memcpy(&tile->values[t*n], &solve->grid[row*n], n*sizeof(double));
+        } else {
+            memset(&tile->values[t*n], 0, n*sizeof(double));
+        }
+    }
+    memcpy(tile->new_values, tile->values, tile->rows*n*sizeof(double));
+}
+
+// Pool task, halo_depth sweeps over the worker's tile
+void sweepTileTask(int worker, int worker_count, void* arg) {
+    TILES_SOLVE* solve = (TILES_SOLVE*)arg;
+    TILE* tile = &solve->tiles[worker];
+    long n = solve->size;
+    int depth = solve->halo_depth;
+
+    for (int s=0 ; s<depth ; s++) {
+        // rows still exact after this sweep, clipped to the grid's interior
+        long first = tile->owned_start - (depth - 1 - s);
+        long last = tile->owned_end - 1 + (depth - 1 - s);
+        first = first < 1 ? 1 : first;
+        last = last > n - 2 ? n - 2 : last;
+
+        int changed = 0;
+        for (long row=first ; row<=last ; row++) {
+            long t = row - tile->first_row;
+            double* up = &tile->values[(t - 1)*n];
+            double* cells = &tile->values[t*n];
+            double* down = &tile->values[(t + 1)*n];
+            double* out = &tile->new_values[t*n];
+            int owned = row >= tile->owned_start && row < tile->owned_end;
+
+            for (long j=1 ; j<n-1 ; j++) {
+                double new_value = (up[j] + cells[j + 1] + down[j] + cells[j - 1])/4;
+                changed |= owned && fabs(new_value - cells[j]) > decimal_value;
+                out[j] = new_value;
+            }
+        }
+        tile->changed = changed;
+
+        double* swap = tile->values;
+        tile->values = tile->new_values;
+        tile->new_values = swap;
+    }
+}
+
+// Pool task, refreshes the worker's ghost rows from the tiles owning them
+void exchangeHaloTask(int worker, int worker_count, void* arg) {
+    TILES_SOLVE* solve = (TILES_SOLVE*)arg;
+    TILE* tile = &solve->tiles[worker];
+    long n = solve->size;
+
+    for (long t=0 ; t<tile->rows ; t++) {
+        long row = tile->first_row + t;
+        if (row < 1 || row > n - 2 || (row >= tile->owned_start && row < tile->owned_end)) {
+            continue;
+        }
+
+        TILE* owner = &solve->tiles[getRowOwner(solve, row)];
+        memcpy(&tile->values[t*n + 1], &owner->values[(row - owner->first_row)*n + 1], (n - 2)*sizeof(double));
+    }
+}
+
+// Pool task, refills the worker's tile, its halos included, from the grid
+void loadTileTask(int worker, int worker_count, void* arg) {
+    TILES_SOLVE* solve = (TILES_SOLVE*)arg;
+    TILE* tile = &solve->tiles[worker];
+    long n = solve->size;
+
+    for (long t=0 ; t<tile->rows ; t++) {
+        long row = tile->first_row + t;
+        if (row >= 0 && row < n) {
+            memcpy(&tile->values[t*n], &solve->grid[row*n], n*sizeof(double));
+        }
+    }
+}
+
+// Pool task, copies the worker's strip back into the grid
+void storeTileTask(int worker, int worker_count, void* arg) {
+    TILES_SOLVE* solve = (TILES_SOLVE*)arg;
+    TILE* tile = &solve->tiles[worker];
+    long n = solve->size;
+
+    for (long row=tile->owned_start ; row<tile->owned_end ; row++) {
+        memcpy(&solve->grid[row*n], &tile->values[(row - tile->first_row)*n], n*sizeof(double));
+    }
+}
+
+// One batch of halo_depth sweeps through the grid, the map Anderson
+// acceleration iterates
+void tilesSweep(void* arg) {
+    runPool(loadTileTask, arg);
+    runPool(sweepTileTask, arg);
+    runPool(storeTileTask, arg);
+}
+
+// Relaxes grid, a size*size matrix, on private tiles exchanging halo_depth
+// ghost rows every halo_depth sweeps. The batches are Anderson accelerated
+// over the last history iterates if history is above 0. Must be called with
+// the pool started with worker_count workers.
+void relaxTiles(double* grid, int size, int halo_depth, int history, int worker_count) {
+    if (size < 3) {
+        return;
+    }
+
+    TILES_SOLVE solve;
+    solve.grid = grid;
+    solve.size = size;
+    solve.halo_depth = halo_depth < 1 ? 1 : halo_depth;
+    solve.worker_count = worker_count;
+    solve.tiles = aligned_alloc(64, worker_count*sizeof(TILE));
+
+    runPool(initTileTask, &solve);
+
+    if (history > 0) {
+        FIXED_POINT_MAP map = {tilesSweep, &solve, &solve.grid, NULL, solve.halo_depth};
+        accelerateAnderson(&map, (long)size*size, decimal_value, history, worker_count);
+    } else {
+        while (1) {
+            runPool(sweepTileTask, &solve);
+
+            int changed = 0;
+            for (int w=0 ; w<worker_count ; w++) {
+                changed |= solve.tiles[w].changed;
+            }
+            if (!changed) {
+                break;
+            }
+
+            runPool(exchangeHaloTask, &solve);
+        }
+        runPool(storeTileTask, &solve);
+    }
+
+    for (int w=0 ; w<worker_count ; w++) {
+        free(solve.tiles[w].values);
+        free(solve.tiles[w].new_values);
+    }
+    free(solve.tiles);
+}
@@ -0,0 +1,201 @@
+/**
+* Transient heat equation time stepping
+* Oliver Redeyoff
+*
+* Instead of the steady state this follows u_t = laplacian(u) from the starting
+* matrix, with the edge cells held fixed, a grid spacing of 1 and a diffusivity
+* of 1. Each step of length dt uses one of:
+*
+* - FTCS (forward Euler), u' = u + dt*(sum of neighbours - 4u), which is only
+*   stable for dt <= 1/4, so larger steps are cut down to that
+*
+* - backward Euler or Crank-Nicolson, the theta scheme with theta 1 or 1/2,
+*   (1 + 4*theta*dt) u' - theta*dt*(sum of neighbours of u') = b with
+*   b = u + (1 - theta)*dt*(sum of neighbours - 4u). Both are stable for any
+*   dt. The system is solved by Jacobi sweeps starting from the previous
+*   step's values, which are close to the answer, until no cell changes by
+*   more than decimal_value
+*
+* The pool and both buffers are set up once for the whole run so a step costs
+* only its sweeps. Every output_every steps the matrix is written with
+* writeMatrix.
+*
+**/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// largest stable FTCS step for a grid spacing and diffusivity of 1
+#define FTCS_STABLE_DT 0.25
+
+// step of the implicit schemes when none is given
+#define IMPLICIT_DEFAULT_DT 1.0
+
+// scheme names accepted by -t, in TRANSIENT_SCHEME order
+char* transient_scheme_names[TRANSIENT_SCHEME_COUNT] = {"ftcs", "euler", "cn"};
+
+// state shared with the pool tasks of one run
+typedef struct transient_solve {
+    long size;
+    double dt;
+    double theta;           // weight of the new step in the implicit schemes
+    double* values;         // current values, read this sweep
+    double* new_values;     // values written this sweep
+    double* rhs;            // b of the implicit schemes
+    int changed;
+} TRANSIENT_SOLVE;
+
+// Returns the scheme with the given name, or -1 if there is none
+int getTransientScheme(char* name) {
+    for (int i=0 ; i<TRANSIENT_SCHEME_COUNT ; i++) {
+        if (strcmp(name, transient_scheme_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Pool task, one FTCS step over the worker's share of rows
+void ftcsStepTask(int worker, int worker_count, void* arg) {
+    TRANSIENT_SOLVE* solve = (TRANSIENT_SOLVE*)arg;
+    long n = solve->size;
+    double dt = solve->dt;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        double* up = &solve->values[(i - 1)*n];
+        double* row = &solve->values[i*n];
+        double* down = &solve->values[(i + 1)*n];
+        double* out = &solve->new_values[i*n];
+
+        for (long j=1 ; j<n-1 ; j++) {
+            out[j] = row[j] + dt*(up[j] + row[j + 1] + down[j] + row[j - 1] - 4*row[j]);
+        }
+    }
+}
+
+// Pool task, the right hand side of an implicit step over the worker's rows
+void transientRhsTask(int worker, int worker_count, void* arg) {
+    TRANSIENT_SOLVE* solve = (TRANSIENT_SOLVE*)arg;
+    long n = solve->size;
+    double explicit_dt = (1 - solve->theta)*solve->dt;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        double* up = &solve->values[(i - 1)*n];
+        double* row = &solve->values[i*n];
+        double* down = &solve->values[(i + 1)*n];
+        double* rhs = &solve->rhs[i*n];
+
+        for (long j=1 ; j<n-1 ; j++) {
+            rhs[j] = row[j] + explicit_dt*(up[j] + row[j + 1] + down[j] + row[j - 1] - 4*row[j]);
+        }
+    }
+}
+
+// Pool task, one Jacobi sweep of an implicit step over the worker's rows. The
+// values can move either way within a step, so the change test is on the
+// absolute difference.
+void implicitSweepTask(int worker, int worker_count, void* arg) {
+    TRANSIENT_SOLVE* solve = (TRANSIENT_SOLVE*)arg;
+    long n = solve->size;
+    double implicit_dt = solve->theta*solve->dt;
+    double scale = 1/(1 + 4*implicit_dt);
+    int changed = 0;
+
+    long start, end;
+    splitRange(worker, worker_count, n - 2, &start, &end);
+
+    for (long i=start+1 ; i<end+1 ; i++) {
+        double* up = &solve->values[(i - 1)*n];
+        double* row = &solve->values[i*n];
+        double* down = &solve->values[(i + 1)*n];
+        double* rhs = &solve->rhs[i*n];
+        double* out = &solve->new_values[i*n];
+
+        for (long j=1 ; j<n-1 ; j++) {
+            double new_value = (rhs[j] + implicit_dt*(up[j] + row[j + 1] + down[j] + row[j - 1]))*scale;
+            changed |= fabs(new_value - row[j]) > decimal_value;
+            out[j] = new_value;
+        }
+    }
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Advances grid, a size*size matrix, by steps steps of length dt (the scheme's
+// default if not positive) with the given scheme, writing it to
+// output_file_name suffixed with the step number every output_every steps
+// (never if 0 or output_file_name is NULL). Must be called with the pool
+// started.
+void runTransient(double* grid, int size, int scheme, long steps, double dt, long output_every, char* output_file_name) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+
+    if (dt <= 0) {
+        dt = scheme == TRANSIENT_FTCS ? FTCS_STABLE_DT : IMPLICIT_DEFAULT_DT;
+    } else if (scheme == TRANSIENT_FTCS && dt > FTCS_STABLE_DT) {
+        printf("Time step cut to %g, the FTCS stability limit\n", FTCS_STABLE_DT);
+        dt = FTCS_STABLE_DT;
+    }
+
+    TRANSIENT_SOLVE solve;
+    solve.size = n;
+    solve.dt = dt;
+    solve.theta = scheme == TRANSIENT_CRANK_NICOLSON ? 0.5 : 1.0;
+    solve.changed = 0;
+    solve.values = malloc(n*n*sizeof(double));
+    solve.new_values = malloc(n*n*sizeof(double));
+    solve.rhs = scheme == TRANSIENT_FTCS ? NULL : malloc(n*n*sizeof(double));
+
+    // the edges are never written so both buffers keep them
+    memcpy(solve.values, grid, n*n*sizeof(double));
+    memcpy(solve.new_values, grid, n*n*sizeof(double));
+
+    for (long step=1 ; step<=steps ; step++) {
+        if (scheme == TRANSIENT_FTCS) {
+            runPool(ftcsStepTask, &solve);
+            double* swap = solve.values;
+            solve.values = solve.new_values;
+            solve.new_values = swap;
+        } else {
+            runPool(transientRhsTask, &solve);
+
+            // the previous step's values are the first guess
+            while (1) {
+                runPool(implicitSweepTask, &solve);
+                double* swap = solve.values;
+                solve.values = solve.new_values;
+                solve.new_values = swap;
+
+                if (!solve.changed) {
+                    break;
+                }
+                solve.changed = 0;
+            }
+        }
+
+        if (output_file_name != NULL && output_every > 0 && step%output_every == 0) {
+            char file_name[4096];
+            snprintf(file_name, sizeof(file_name), "%s.%ld", output_file_name, step);
+            writeMatrix(file_name, solve.values);
+        }
+    }
+
+    memcpy(grid, solve.values, n*n*sizeof(double));
+    free(solve.values);
+    free(solve.new_values);
+    free(solve.rhs);
+}
@@ -0,0 +1,287 @@
+/**
+* Cache oblivious trapezoidal decomposition of the sweeps
+* Oliver Redeyoff
+*
+* relaxMatrix streams the whole matrix through the cache once per sweep. A
+* cell's value after the next sweep only needs its neighbours' current values,
+* so the sweeps can instead be done a region of space and time at a time, the
+* way Frigo and Strumpen cut the space-time domain of a stencil:
+*
+* - a trapezoid is a range of sweeps and, for each sweep, a range of rows and
+*   of columns whose ends move by -1, 0 or +1 cells per sweep. It is cut in
+*   space, along rows or columns, into 2 trapezoids when it is more than twice
+*   as wide as it is tall, the cut leaning back by 1 cell per sweep so that
+*   the first half has everything the second half reads, and otherwise cut in
+*   time into a lower and an upper half. The recursion stops at a single
+*   sweep or an area of about STENCIL_BASE_CELLS, whose sweeps are run
+*   directly. Every level of the recursion reuses what the cache holds from
+*   its first half, whatever size the cache is, so no tile size is tuned for a
+*   machine
+*
+* - the sweeps are done in blocks. Each block cuts the rows into one strip per
+*   worker, each strip narrowing by 1 cell per sweep on every side that isn't
+*   the matrix's edge, and the strips are walked in parallel. After the
+*   workers meet, the inverted trapezoids between neighbouring strips, which
+*   widen by 1 cell per sweep, are walked in parallel. A block has half as
+*   many sweeps as a strip is wide, so the strips never narrow to nothing
+*
+* - values alternate between 2 buffers, the one holding a sweep's result
+*   being given by the parity of the sweep. The cuts leaning by 1 cell per
+*   sweep guarantee a value is never overwritten while something still needs
+*   to read it
+*
+* The relaxation stops when the last sweep of a block changes no cell by more
+* than decimal_value, so it may run a few more sweeps than relaxMatrix would.
+* Values can move either way, so the change test is on the absolute
+* difference. Anderson acceleration, when asked for, mixes after every block,
+* each block starting from the even buffer.
+*
+**/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "relaxation_technique.h"
+
+// area in cells below which a trapezoid's sweeps are run directly
+#define STENCIL_BASE_CELLS 2048
+
+// a trapezoid, whose rows at sweep t are [x0 + dx0*(t - t0), x1 + dx1*(t - t0))
+// and likewise for its columns with y
+typedef struct trapezoid {
+    long t0;
+    long t1;
+    long x0;
+    long dx0;
+    long x1;
+    long dx1;
+    long y0;
+    long dy0;
+    long y1;
+    long dy1;
+} TRAPEZOID;
+
+// state shared with the pool tasks of one solve
+typedef struct trapezoid_solve {
+    long size;
+    double* buffers[2];     // values after even and after odd sweeps
+    long block_start;       // first sweep of the block
+    long block_steps;       // sweeps in the block
+    int strip_count;
+    long* cuts;             // first row of each strip, then the row after the last
+    int changed;
+} TRAPEZOID_SOLVE;
+
+// Runs the sweeps of a trapezoid directly, noting in changed if the last sweep
+// of the block moves a cell by more than decimal_value
+void sweepTrapezoid(TRAPEZOID_SOLVE* solve, TRAPEZOID* z, int* changed) {
+    long n = solve->size;
+    long last_step = solve->block_start + solve->block_steps - 1;
+    double threshold = decimal_value;
+
+    for (long t=z->t0 ; t<z->t1 ; t++) {
+        long elapsed = t - z->t0;
+        long row_start = z->x0 + z->dx0*elapsed;
+        long row_end = z->x1 + z->dx1*elapsed;
+        long col_start = z->y0 + z->dy0*elapsed;
+        long col_end = z->y1 + z->dy1*elapsed;
+        const double* values = solve->buffers[t%2];
+        double* new_values = solve->buffers[(t + 1)%2];
+        int check = t == last_step;
+
+        for (long i=row_start ; i<row_end ; i++) {
+            const double* up = &values[(i - 1)*n];
+            const double* row = &values[i*n];
+            const double* down = &values[(i + 1)*n];
+            double* out = &new_values[i*n];
+            int row_changed = 0;
+
+            for (long j=col_start ; j<col_end ; j++) {
+                double new_value = (up[j] + row[j + 1] + down[j] + row[j - 1])/4;
+                row_changed |= fabs(new_value - row[j]) > threshold;
+                out[j] = new_value;
+            }
+            *changed |= check && row_changed;
+        }
+    }
+}
+
+// Walks a trapezoid, cutting it recursively in space or time until the pieces
+// are small enough to sweep directly
+void walkTrapezoid(TRAPEZOID_SOLVE* solve, TRAPEZOID* z, int* changed) {
+    long dt = z->t1 - z->t0;
+    if (dt < 1) {
+        return;
+    }
+
+    // twice the average width along the rows and the columns
+    long width_x = 2*(z->x1 - z->x0) + (z->dx1 - z->dx0)*dt;
+    long width_y = 2*(z->y1 - z->y0) + (z->dy1 - z->dy0)*dt;
+    if (dt == 1 || width_x*width_y <= 4*STENCIL_BASE_CELLS) {
+        sweepTrapezoid(solve, z, changed);
+        return;
+    }
+
+    if (width_x >= 4*dt) {
+        // space cut across the rows, both halves leaning back
+        long middle = (2*(z->x0 + z->x1) + (2 + z->dx0 + z->dx1)*dt)/4;
+        TRAPEZOID first = *z;
+        first.x1 = middle;
+        first.dx1 = -1;
+        walkTrapezoid(solve, &first, changed);
+        TRAPEZOID second = *z;
+        second.x0 = middle;
+        second.dx0 = -1;
+        walkTrapezoid(solve, &second, changed);
+    } else if (width_y >= 4*dt) {
+        // space cut across the columns
+        long middle = (2*(z->y0 + z->y1) + (2 + z->dy0 + z->dy1)*dt)/4;
+        TRAPEZOID first = *z;
+        first.y1 = middle;
+        first.dy1 = -1;
+        walkTrapezoid(solve, &first, changed);
+        TRAPEZOID second = *z;
+        second.y0 = middle;
+        second.dy0 = -1;
+        walkTrapezoid(solve, &second, changed);
+    } else {
+        // time cut, the upper half starting where the lower one ends
+        long half = dt/2;
+        TRAPEZOID lower = *z;
+        lower.t1 = z->t0 + half;
+        walkTrapezoid(solve, &lower, changed);
+        TRAPEZOID upper = *z;
+        upper.t0 = z->t0 + half;
+        upper.x0 += z->dx0*half;
+        upper.x1 += z->dx1*half;
+        upper.y0 += z->dy0*half;
+        upper.y1 += z->dy1*half;
+        walkTrapezoid(solve, &upper, changed);
+    }
+}
+
+// Pool task, walks the worker's strip of the block, narrowing on the sides
+// that meet another strip
+void stripTask(int worker, int worker_count, void* arg) {
+    TRAPEZOID_SOLVE* solve = (TRAPEZOID_SOLVE*)arg;
+    if (worker >= solve->strip_count) {
+        return;
+    }
+    long n = solve->size;
+    int changed = 0;
+
+    TRAPEZOID z = {solve->block_start, solve->block_start + solve->block_steps,
+            solve->cuts[worker], worker == 0 ? 0 : 1,
+            solve->cuts[worker + 1], worker == solve->strip_count - 1 ? 0 : -1,
+            1, 0, n - 1, 0};
+    walkTrapezoid(solve, &z, &changed);
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Pool task, walks the inverted trapezoid widening from the cut above the
+// worker's strip, between it and the strip before
+void gapTask(int worker, int worker_count, void* arg) {
+    TRAPEZOID_SOLVE* solve = (TRAPEZOID_SOLVE*)arg;
+    if (worker == 0 || worker >= solve->strip_count) {
+        return;
+    }
+    long n = solve->size;
+    int changed = 0;
+
+    TRAPEZOID z = {solve->block_start, solve->block_start + solve->block_steps,
+            solve->cuts[worker], -1, solve->cuts[worker], 1,
+            1, 0, n - 1, 0};
+    walkTrapezoid(solve, &z, &changed);
+
+    if (changed) {
+        solve->changed = 1;
+    }
+}
+
+// Runs the next block of sweeps, strips then the gaps between them
+void trapezoidBlock(TRAPEZOID_SOLVE* solve) {
+    runPool(stripTask, solve);
+    runPool(gapTask, solve);
+    solve->block_start += solve->block_steps;
+}
+
+// One block from the values in the even buffer to their image in the same
+// buffer, the map Anderson acceleration iterates
+void trapezoidMap(void* arg) {
+    TRAPEZOID_SOLVE* solve = (TRAPEZOID_SOLVE*)arg;
+    trapezoidBlock(solve);
+    if (solve->block_steps%2 == 1) {
+        memcpy(solve->buffers[0], solve->buffers[1], solve->size*solve->size*sizeof(double));
+    }
+    solve->block_start = 0;
+}
+
+// Relaxes grid, a size*size matrix, in blocks of sweeps walked as cache
+// oblivious trapezoids until the last sweep of a block changes no value by more
+// than decimal_value. The blocks are Anderson accelerated over the last history
+// iterates if history is above 0. Must be called with the pool started.
+void relaxTrapezoids(double* grid, int size, int history, int worker_count) {
+    long n = size;
+    if (n < 3) {
+        return;
+    }
+
+    TRAPEZOID_SOLVE solve;
+    solve.size = n;
+    solve.changed = 0;
+
+    // strips at least 2 rows wide, a block half as many sweeps as the
+    // narrowest strip has rows
+    solve.strip_count = worker_count < (n - 2)/2 ? worker_count : (n - 2)/2;
+    if (solve.strip_count < 1) {
+        solve.strip_count = 1;
+    }
+    solve.cuts = malloc((solve.strip_count + 1)*sizeof(long));
+    for (int k=0 ; k<solve.strip_count ; k++) {
+        long start, end;
+        splitRange(k, solve.strip_count, n - 2, &start, &end);
+        solve.cuts[k] = start + 1;
+    }
+    solve.cuts[solve.strip_count] = n - 1;
+    solve.block_steps = (n - 2)/solve.strip_count/2;
+    if (solve.block_steps < 1) {
+        solve.block_steps = 1;
+    }
+
+    solve.buffers[0] = malloc(n*n*sizeof(double));
+    solve.buffers[1] = malloc(n*n*sizeof(double));
+    memcpy(solve.buffers[0], grid, n*n*sizeof(double));
+    memcpy(solve.buffers[1], grid, n*n*sizeof(double));
+
+    solve.block_start = 0;
+    if (history > 0) {
+        // mixing after no more sweeps than a run of the other modes, and an
+        // even number of them so that the image lands in the even buffer
+        // without a copy unless a block is a single sweep
+        if (solve.block_steps > ANDERSON_SWEEPS) {
+            solve.block_steps = ANDERSON_SWEEPS;
+        }
+        if (solve.block_steps > 1) {
+            solve.block_steps -= solve.block_steps%2;
+        }
+        FIXED_POINT_MAP map = {trapezoidMap, &solve, &solve.buffers[0], NULL, solve.block_steps};
+        accelerateAnderson(&map, n*n, decimal_value, history, worker_count);
+    } else {
+        while (1) {
+            trapezoidBlock(&solve);
+            if (!solve.changed) {
+                break;
+            }
+            solve.changed = 0;
+        }
+    }
+
+    memcpy(grid, solve.buffers[solve.block_start%2], n*n*sizeof(double));
+    free(solve.buffers[0]);
+    free(solve.buffers[1]);
+    free(solve.cuts);
+}
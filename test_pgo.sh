@@ -0,0 +1,25 @@
+# Training and benchmarking for the profile guided build, run by `make pgo`
+#   bash test_pgo.sh train <instrumented binary>
+#   bash test_pgo.sh bench <release binary> <pgo binary>
+
+if [ "$1" = "train" ]
+then
+    # a spread of the sizes and thread counts used by the other test scripts
+    for size in 100 200 400
+    do
+        for threads in 1 4 8
+        do
+            $2 $size $threads 3 > /dev/null
+        done
+    done
+fi
+
+if [ "$1" = "bench" ]
+then
+    for size in 200 400
+    do
+        base=$($2 $size 4 3 | cut -d, -f2)
+        pgo=$($3 $size 4 3 | cut -d, -f2)
+        echo "$size, $base, $pgo" | awk -F', ' '{ printf "%d, release %fs, pgo %fs, gain %.1f%%\n", $1, $2, $3, 100*($2-$3)/$2 }'
+    done
+fi
@@ -20,7 +20,7 @@
 
 typedef struct relaxationData
 {
-    int bounds[2];
+    long bounds[2];
     double *old_values;
     double *new_values;
     int ARRAY_DIMENSIONS_SQRT;
@@ -40,7 +40,8 @@ void start_relaxation_thread(RelaxationData *relaxation_data);
 int main(int argc, char *argv[])
 {
 
-    int ARRAY_DIMENSIONS, ARRAY_DIMENSIONS_SQRT, NUM_THREADS, GENERATE;
+    long ARRAY_DIMENSIONS;
+    int ARRAY_DIMENSIONS_SQRT, NUM_THREADS, GENERATE;
     unsigned long long DATA_SIZE = sizeof(double);
     double PRECISION;
     char *INPUT_FILE_NAME = "", *OUTPUT_FILE_NAME = "";
@@ -72,8 +73,8 @@ int main(int argc, char *argv[])
                 printf("ERROR ARRAY_DIMENSIONS could not be determined from '%s'\n", optarg);
                 return -1;
             }
-            ARRAY_DIMENSIONS = ARRAY_DIMENSIONS_SQRT * ARRAY_DIMENSIONS_SQRT;
-            DATA_SIZE *= (unsigned)ARRAY_DIMENSIONS;
+            ARRAY_DIMENSIONS = (long)ARRAY_DIMENSIONS_SQRT * ARRAY_DIMENSIONS_SQRT;
+            DATA_SIZE *= (unsigned long long)ARRAY_DIMENSIONS;
             break;
 
         case 'f':
@@ -114,8 +115,8 @@ int main(int argc, char *argv[])
     // Perform relaxation
 
     int precision_reached = 0;
-    int inner_array_size = (ARRAY_DIMENSIONS_SQRT - 2) * (ARRAY_DIMENSIONS_SQRT - 2);
-    int bucket_size = inner_array_size / NUM_THREADS;
+    long inner_array_size = (long)(ARRAY_DIMENSIONS_SQRT - 2) * (ARRAY_DIMENSIONS_SQRT - 2);
+    long bucket_size = inner_array_size / NUM_THREADS;
 
     pthread_t threads[NUM_THREADS];
     RelaxationData thread_data[NUM_THREADS];
@@ -128,8 +129,8 @@ int main(int argc, char *argv[])
     // Create thread to work on each bound of data
     for (int i = 0; i < NUM_THREADS; i++)
     {
-        int lower = i * bucket_size;
-        int upper = lower + bucket_size;
+        long lower = i * bucket_size;
+        long upper = lower + bucket_size;
 
         thread_data[i] = (RelaxationData){
             {lower, upper},
@@ -208,7 +209,7 @@ void print_values(int dimension, double values[])
     {
         for (int j = 0; j < dimension; j++)
         {
-            printf("%.10f\t", values[i * dimension + j]);
+            printf("%.10f\t", values[(long)i * dimension + j]);
         }
         printf("\n");
     }
@@ -225,8 +226,8 @@ void print_values(int dimension, double values[])
 void load_data(char *file_name, double values[], int dimensions)
 {
     FILE *file = fopen(file_name, "r");
-    int line_num = 0;
-    int col_num = 0;
+    long line_num = 0;
+    long col_num = 0;
 
     char c;
     char digits[1080]; // 1077 is maximum number of characters for a double
@@ -263,8 +264,8 @@ void load_data(char *file_name, double values[], int dimensions)
 }
 
 void generate_data(double *values, int dimensions) {
-    for (int i = 0; i < dimensions; i++) {
-        for (int j = 0; j < dimensions; j++) {
+    for (long i = 0; i < dimensions; i++) {
+        for (long j = 0; j < dimensions; j++) {
             if (i == 0 || j == 0){
                 values[i * dimensions + j] = 1.0;
             } else {
@@ -285,8 +286,8 @@ void write_data(char *file_name, double values[], int dimensions)
 {
     FILE *file = fopen(file_name, "w");
 
-    for (int i = 0; i < dimensions; i++) {
-        for (int j = 0; j < dimensions; j++) {
+    for (long i = 0; i < dimensions; i++) {
+        for (long j = 0; j < dimensions; j++) {
             char str[1080];
             sprintf(str, "%f", values[dimensions*i + j]);
             fputs(str, file);
@@ -311,16 +312,22 @@ void start_relaxation_thread(RelaxationData *relaxation_data)
 {   
     while (1) {
         int precision_reached = 1;
-        for (int i = relaxation_data->bounds[0]; i < relaxation_data->bounds[1]; i++)
+        long dimension = relaxation_data->ARRAY_DIMENSIONS_SQRT;
+        long inner_array_size = dimension - 2;
+
+        // work out the row and column of the first inner cell once, then step
+        // them along instead of dividing for every cell
+        long i = relaxation_data->bounds[0];
+        long row_number = (1 + (i / inner_array_size)) * dimension;
+        long column_number = i % inner_array_size + 1;
+
+        for ( ; i < relaxation_data->bounds[1]; i++)
         {
-            int inner_array_size = relaxation_data->ARRAY_DIMENSIONS_SQRT - 2;
-            int row_number = (1 + (i / inner_array_size)) * relaxation_data->ARRAY_DIMENSIONS_SQRT;
-            int column_number = i % inner_array_size + 1;
-            int position = row_number + column_number;
+            long position = row_number + column_number;
             double sum_of_values = 0;
 
-            sum_of_values += relaxation_data->old_values[position - relaxation_data->ARRAY_DIMENSIONS_SQRT];
-            sum_of_values += relaxation_data->old_values[position + relaxation_data->ARRAY_DIMENSIONS_SQRT];
+            sum_of_values += relaxation_data->old_values[position - dimension];
+            sum_of_values += relaxation_data->old_values[position + dimension];
             sum_of_values += relaxation_data->old_values[position - 1];
             sum_of_values += relaxation_data->old_values[position + 1];
 
@@ -330,6 +337,13 @@ void start_relaxation_thread(RelaxationData *relaxation_data)
                 relaxation_data->new_values[i]);
 
             precision_reached &= diff < relaxation_data->PRECISION;
+
+            column_number++;
+            if (column_number > inner_array_size)
+            {
+                column_number = 1;
+                row_number += dimension;
+            }
         }
         relaxation_data->result = precision_reached;
         pthread_barrier_wait(relaxation_data->completed);